@@ -0,0 +1,307 @@
+// Micro-benchmarks of the hot kernels of unboxing, each run in isolation on
+// frame sized buffers:
+//
+//   bench [--reps=N] [--warmup=N] [--filter=<substring>] <control frame image>
+//
+// The control frame image (a 4k PNG scan, e.g. frame 1 of a reel) is decoded
+// once up front and is the input of the CRC64, SHA1 and unboxing kernels.
+
+#include "../dep/afs/src/sha1hash.c"
+#include "../dep/afs/unboxing/tests/testutils/src/config_source_4k_controlframe_v7.h"
+#include "../src/crc64.c"
+#include "../src/load_image.c"
+#include "../src/raw_file.c"
+#include "../src/stats.c"
+#include "../src/unboxer_helpers.c"
+#include <boxing/config.h>
+#include <boxing/math/crc64.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  const char *name;
+  size_t bytes; // bytes processed per iteration, for throughput
+  bool (*run)(void *ctx);
+  void *ctx;
+} Kernel;
+
+typedef struct {
+  Slice file;
+  int width;
+  int height;
+  ImageArena arena;
+} DecodeContext;
+
+static bool runDecode(void *ctx) {
+  DecodeContext *c = ctx;
+  image_reset(&c->arena);
+  int width, height;
+  unsigned char *data =
+      stbi_load_from_memory((unsigned char *)c->file.data, (int)c->file.size,
+                            &width, &height, NULL, 1);
+  return data && width == c->width && height == c->height;
+}
+
+typedef struct {
+  Slice packed;
+  uint32_t width;
+  uint32_t height;
+  uint8_t color_depth;
+  Slice output;
+} SplatContext;
+
+static bool runSplat(void *ctx) {
+  SplatContext *c = ctx;
+  return splat_pixels(c->packed.data, c->width, c->height, c->color_depth,
+                      &c->output);
+}
+
+typedef struct {
+  dcrc64 *crc;
+  Crc64 sliced;
+  Slice data;
+} CrcContext;
+
+static bool runCrc64(void *ctx) {
+  CrcContext *c = ctx;
+  boxing_math_crc64_reset(c->crc, 0);
+  boxing_math_crc64_calc_crc(c->crc, (const char *)c->data.data,
+                             (unsigned)c->data.size);
+  return true;
+}
+
+static bool runCrc64Sliced(void *ctx) {
+  CrcContext *c = ctx;
+  crc64_update(&c->sliced, 0, c->data.data, c->data.size);
+  return true;
+}
+
+static bool runSha1(void *ctx) {
+  const Slice *data = ctx;
+  afs_hash1_state sha1;
+  unsigned char digest[20];
+  return afs_sha1_init(&sha1) == CRYPT_OK &&
+         afs_sha1_process(&sha1, data->data, (unsigned long)data->size) ==
+             CRYPT_OK &&
+         afs_sha1_done(&sha1, digest) == CRYPT_OK;
+}
+
+typedef struct {
+  Unboxer unboxer;
+  Slice image;
+  uint32_t width;
+  uint32_t height;
+  Slice buffer;
+} UnboxContext;
+
+static bool runUnbox(void *ctx) {
+  UnboxContext *c = ctx;
+  Slice result;
+  return UnboxerUnbox(&c->unboxer, c->image.data, c->width, c->height,
+                      BOXING_METADATA_CONTENT_TYPES_CONTROLFRAME, &c->buffer,
+                      &result, NULL) == UnboxOK;
+}
+
+typedef struct {
+  double min_ms;
+  double median_ms;
+  double mean_ms;
+  double stddev_ms;
+  double p95_ms;
+} Timings;
+
+static Timings summarize(uint64_t *samples, unsigned count) {
+  qsort(samples, count, sizeof *samples, compareU64);
+  double sum = 0;
+  for (unsigned i = 0; i < count; i++)
+    sum += (double)samples[i] / 1e6;
+  const double mean = sum / count;
+  double variance = 0;
+  for (unsigned i = 0; i < count; i++) {
+    const double d = (double)samples[i] / 1e6 - mean;
+    variance += d * d;
+  }
+  return (Timings){
+      .min_ms = (double)samples[0] / 1e6,
+      .median_ms = percentileMs(samples, count, 50),
+      .mean_ms = mean,
+      .stddev_ms = count > 1 ? sqrt(variance / (count - 1)) : 0,
+      .p95_ms = percentileMs(samples, count, 95),
+  };
+}
+
+static bool runKernel(const Kernel *k, unsigned warmup, unsigned reps,
+                      uint64_t *samples) {
+  for (unsigned i = 0; i < warmup; i++)
+    if (!k->run(k->ctx))
+      return false;
+  for (unsigned i = 0; i < reps; i++) {
+    const uint64_t t0 = clock_now_ns();
+    if (!k->run(k->ctx))
+      return false;
+    samples[i] = clock_now_ns() - t0;
+  }
+  const Timings t = summarize(samples, reps);
+  printf("%-22s %9.3f %9.3f %9.3f %9.3f %9.3f %10.1f\n", k->name, t.min_ms,
+         t.median_ms, t.mean_ms, t.stddev_ms, t.p95_ms,
+         t.median_ms > 0 ? (double)k->bytes / 1e6 / (t.median_ms / 1e3) : 0.0);
+  return true;
+}
+
+static const char *optionValue(const char *const restrict arg,
+                               const char *const restrict name) {
+  const size_t len = strlen(name);
+  if (strncmp(arg, name, len) == 0 && arg[len] == '=')
+    return arg + len + 1;
+  return NULL;
+}
+
+// xorshift64, good enough to keep the splat kernels from seeing runs of zeros
+static void fillRandom(Slice s) {
+  uint64_t x = 0x9e3779b97f4a7c15ull;
+  for (size_t i = 0; i < s.size; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    ((uint8_t *)s.data)[i] = (uint8_t)x;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  unsigned reps = 20;
+  unsigned warmup = 3;
+  const char *filter = NULL;
+  const char *path = NULL;
+  bool bad_arguments = false;
+  for (int i = 1; i < argc; i++) {
+    const char *value;
+    if ((value = optionValue(argv[i], "--reps")))
+      reps = (unsigned)strtoul(value, NULL, 10);
+    else if ((value = optionValue(argv[i], "--warmup")))
+      warmup = (unsigned)strtoul(value, NULL, 10);
+    else if ((value = optionValue(argv[i], "--filter")))
+      filter = value;
+    else if (!path && strncmp(argv[i], "--", 2) != 0)
+      path = argv[i];
+    else
+      bad_arguments = true;
+  }
+  if (bad_arguments || !path || !reps) {
+    fprintf(stderr,
+            "Usage: %s [--reps=N] [--warmup=N] [--filter=<substring>] "
+            "<control frame image>\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  DecodeContext decode = {.file = mapFile(path)};
+  if (!decode.file.data) {
+    fprintf(stderr, "%s: failed to map file\n", path);
+    return EXIT_FAILURE;
+  }
+  if (!image_init(&decode.arena)) {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+  // stb_image allocates from the arena of the calling thread
+  image_arena = &decode.arena;
+  unsigned char *pixels =
+      stbi_load_from_memory((unsigned char *)decode.file.data,
+                            (int)decode.file.size, &decode.width,
+                            &decode.height, NULL, 1);
+  if (!pixels) {
+    fprintf(stderr, "%s: %s\n", path, stbi_failure_reason());
+    return EXIT_FAILURE;
+  }
+  // Other kernels get their own copy, the decode kernel reuses the arena
+  const size_t frame_size = (size_t)decode.width * (size_t)decode.height;
+  Slice frame = {.data = malloc(frame_size), .size = frame_size};
+  if (!frame.data)
+    return EXIT_FAILURE;
+  memcpy(frame.data, pixels, frame_size);
+
+  SplatContext splat[3];
+  const uint8_t depths[3] = {1, 2, 8};
+  for (int i = 0; i < 3; i++) {
+    const size_t packed_size = frame_size * depths[i] / 8;
+    splat[i] = (SplatContext){
+        .packed = {.data = malloc(packed_size), .size = packed_size},
+        .width = (uint32_t)decode.width,
+        .height = (uint32_t)decode.height,
+        .color_depth = depths[i],
+        .output = Slice_empty,
+    };
+    if (!splat[i].packed.data)
+      return EXIT_FAILURE;
+    fillRandom(splat[i].packed);
+  }
+
+  CrcContext crc = {.crc = boxing_math_crc64_create_def(), .data = frame};
+  if (!crc.crc)
+    return EXIT_FAILURE;
+  if (!crc64_init(&crc.sliced))
+    fprintf(stderr, "crc64/slice8 does not match the library\n");
+
+  boxing_config *config =
+      boxing_config_create_from_structure(&config_source_v7);
+  if (!config)
+    return EXIT_FAILURE;
+  UnboxContext unbox = {
+      .image = frame,
+      .width = (uint32_t)decode.width,
+      .height = (uint32_t)decode.height,
+      .buffer = Slice_empty,
+  };
+  if (UnboxerCreate(config, decode.width == 4096 && decode.height == 2160,
+                    &unbox.unboxer) != UnboxerInitOK) {
+    boxing_config_free(config);
+    return EXIT_FAILURE;
+  }
+
+  const Kernel kernels[] = {
+      {"stbi_load_from_memory", frame_size, runDecode, &decode},
+      {"splat_pixels/1", frame_size, runSplat, &splat[0]},
+      {"splat_pixels/2", frame_size, runSplat, &splat[1]},
+      {"splat_pixels/8", frame_size, runSplat, &splat[2]},
+      {"crc64", frame_size, runCrc64, &crc},
+      {"crc64/slice8", frame_size, runCrc64Sliced, &crc},
+      {"sha1", frame_size, runSha1, &frame},
+      {"UnboxerUnbox", frame_size, runUnbox, &unbox},
+  };
+
+  uint64_t *samples = malloc(reps * sizeof *samples);
+  if (!samples)
+    return EXIT_FAILURE;
+  printf("%dx%d frame, %u warm-up + %u timed iterations, times in ms, "
+         "throughput over %zu bytes per iteration\n",
+         decode.width, decode.height, warmup, reps, frame_size);
+  printf("%-22s %9s %9s %9s %9s %9s %10s\n", "kernel", "min", "median", "mean",
+         "stddev", "p95", "MB/s");
+  int status = EXIT_SUCCESS;
+  for (size_t i = 0; i < countof(kernels); i++) {
+    if (filter && !strstr(kernels[i].name, filter))
+      continue;
+    if (!runKernel(&kernels[i], warmup, reps, samples)) {
+      fprintf(stderr, "%s failed\n", kernels[i].name);
+      status = EXIT_FAILURE;
+    }
+  }
+
+  free(samples);
+  free(unbox.buffer.data);
+  UnboxerDestroy(&unbox.unboxer);
+  boxing_config_free(config);
+  boxing_math_crc64_free(crc.crc);
+  for (int i = 0; i < 3; i++) {
+    free(splat[i].packed.data);
+    free(splat[i].output.data);
+  }
+  free(frame.data);
+  image_deinit(&decode.arena);
+  unmapFile(decode.file);
+  return status;
+}
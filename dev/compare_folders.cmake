@@ -0,0 +1,32 @@
+# compare_folders(<expected> <actual>) fails the script unless both folders
+# hold the same files with the same contents, ignoring the journals and caches
+# unbox keeps next to its output
+
+function(unbox_output_files folder out)
+    get_filename_component(folder "${folder}" ABSOLUTE)
+    file(GLOB_RECURSE files RELATIVE "${folder}" "${folder}/*")
+    list(FILTER files EXCLUDE REGEX
+        "(^|/)(journal_|control_frame_|toc_|fingerprint_)[^/]*$")
+    list(SORT files)
+    set(${out} ${files} PARENT_SCOPE)
+endfunction()
+
+function(compare_folders expected actual)
+    unbox_output_files("${expected}" expected_files)
+    unbox_output_files("${actual}" actual_files)
+    if(NOT expected_files)
+        message(FATAL_ERROR "${expected}: no files")
+    endif()
+    if(NOT expected_files STREQUAL actual_files)
+        message(FATAL_ERROR
+            "${actual}: files differ from ${expected}\n"
+            "expected: ${expected_files}\nactual: ${actual_files}")
+    endif()
+    foreach(name ${expected_files})
+        file(SHA256 "${expected}/${name}" expected_hash)
+        file(SHA256 "${actual}/${name}" actual_hash)
+        if(NOT expected_hash STREQUAL actual_hash)
+            message(FATAL_ERROR "${actual}/${name}: differs from ${expected}")
+        endif()
+    endforeach()
+endfunction()
@@ -0,0 +1,7 @@
+# Compares the output folder ACTUAL with the folder run in EXPECTED:
+#
+#   cmake -DEXPECTED=<folder> -DACTUAL=<folder> -P dev/compare_test.cmake
+
+include("${CMAKE_CURRENT_LIST_DIR}/compare_folders.cmake")
+
+compare_folders("${EXPECTED}" "${ACTUAL}")
@@ -0,0 +1,108 @@
+// Runs two unbox contexts at once, each on a thread of its own, over the same
+// reel into two output folders:
+//
+//   context_test <reel> <output folder a> <output folder b>
+//
+// Context a logs everything from a background thread, context b only warnings
+// and up, directly. Fails if a run fails, if a sink gets no messages, or if a
+// message logged by a reaches the sink of b. dev/context_test.cmake compares
+// the output folders with a run of the unbox executable.
+
+#include "../src/libunbox.h"
+#include "../src/threads.c"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+  Mutex mutex;
+  unsigned messages;
+  unsigned debug_messages;
+  unsigned info_messages;
+} SinkCounts;
+
+typedef struct {
+  const char *input;
+  const char *output_folder;
+  unbox_options options;
+  SinkCounts counts;
+  bool ok;
+} Run;
+
+static void countMessage(void *user, enum unbox_log_level level,
+                         const char *message, size_t length) {
+  (void)message;
+  (void)length;
+  SinkCounts *counts = user;
+  mutex_lock(&counts->mutex);
+  counts->messages++;
+  if (level == UNBOX_LOG_DEBUG)
+    counts->debug_messages++;
+  else if (level == UNBOX_LOG_INFO)
+    counts->info_messages++;
+  mutex_unlock(&counts->mutex);
+}
+
+static void runContext(void *arg) {
+  Run *run = arg;
+  unbox_context *context = unbox_context_create(&run->options);
+  if (!context)
+    return;
+  run->ok = unbox_reel(context, run->input, run->output_folder);
+  // Flushes the messages still queued for an async sink
+  unbox_context_destroy(context);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 4) {
+    fprintf(stderr, "Usage: %s <reel> <output folder a> <output folder b>\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  Run runs[2];
+  for (int i = 0; i < 2; i++) {
+    runs[i] = (Run){.input = argv[1], .output_folder = argv[2 + i]};
+    unbox_options_default(&runs[i].options);
+    runs[i].options.log_sink = countMessage;
+    runs[i].options.log_user = &runs[i].counts;
+    runs[i].options.dedup = UNBOX_DEDUP_OFF;
+    mutex_init(&runs[i].counts.mutex);
+  }
+  runs[0].options.log_level = UNBOX_LOG_DEBUG;
+  runs[0].options.log_async = true;
+  runs[1].options.log_level = UNBOX_LOG_WARNING;
+
+  Thread threads[2];
+  int started = 0;
+  while (started < 2 &&
+         thread_start(&threads[started], runContext, &runs[started]))
+    started++;
+  for (int i = 0; i < started; i++)
+    thread_join(threads[i]);
+  if (started < 2) {
+    fprintf(stderr, "Failed to create thread\n");
+    return EXIT_FAILURE;
+  }
+
+  bool ok = true;
+  for (int i = 0; i < 2; i++) {
+    const SinkCounts *counts = &runs[i].counts;
+    printf("%s: %s, %u messages (%u debug, %u info)\n", runs[i].output_folder,
+           runs[i].ok ? "OK" : "FAILED", counts->messages,
+           counts->debug_messages, counts->info_messages);
+    ok = ok && runs[i].ok && counts->messages;
+    mutex_destroy(&runs[i].counts.mutex);
+  }
+  // Frame summaries are logged at debug, only a sees them
+  if (!runs[0].counts.debug_messages) {
+    fprintf(stderr, "%s: no debug messages\n", runs[0].output_folder);
+    ok = false;
+  }
+  if (runs[1].counts.debug_messages || runs[1].counts.info_messages) {
+    fprintf(stderr, "%s: got messages below its log level\n",
+            runs[1].output_folder);
+    ok = false;
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
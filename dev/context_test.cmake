@@ -0,0 +1,18 @@
+# Runs CONTEXT_TEST over REEL into two folders under OUT and compares both
+# with the folder run in EXPECTED:
+#
+#   cmake -DCONTEXT_TEST=<context_test> -DREEL=<frame folder> -DOUT=<folder>
+#         -DEXPECTED=<folder> -P dev/context_test.cmake
+
+include("${CMAKE_CURRENT_LIST_DIR}/compare_folders.cmake")
+
+file(REMOVE_RECURSE "${OUT}")
+execute_process(
+    COMMAND "${CONTEXT_TEST}" "${REEL}" "${OUT}/a" "${OUT}/b"
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "context_test failed: ${result}")
+endif()
+compare_folders("${EXPECTED}" "${OUT}/a")
+compare_folders("${EXPECTED}" "${OUT}/b")
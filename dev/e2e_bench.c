@@ -0,0 +1,420 @@
+// End-to-end benchmark of the unbox executable: runs the whole control frame
+// -> TOC -> file extraction path a number of times per variant and reports
+// frames/s, MB/s and peak RSS as JSON on stdout. Variants are warm or cold
+// page cache, and one or several concurrent unbox processes.
+//
+//   e2e_bench [options] <unbox> <input folder> <output folder>
+
+#include "../src/iterate_dir.c"
+#include "../src/stats.c"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_RUNS 64
+#define MAX_JOBS 64
+#define MAX_THRESHOLDS 64
+
+typedef struct {
+  const char *unbox;
+  const char *input_folder;
+  const char *output_folder;
+  const char *thresholds;
+  unsigned runs;
+  unsigned jobs;
+  bool warm;
+  bool cold;
+} Options;
+
+typedef struct {
+  double frames_per_s;
+  double mb_per_s;
+  double peak_rss_mb;
+} RunResult;
+
+typedef struct {
+  char variant[32];
+  char metric[32];
+  bool is_min; // "min": a lower value is a regression, "max": a higher one
+  double value;
+} Threshold;
+
+static const char *const usage =
+    "Usage: %s [options] <unbox> <input folder> <output folder>\n"
+    "  --runs=N        Timed runs per variant (default 5)\n"
+    "  --jobs=N        Concurrent unbox processes in the multi-process "
+    "variants\n"
+    "                  (default: number of CPUs)\n"
+    "  --cache=warm|cold|both  Page cache state before each run (default "
+    "both)\n"
+    "  --thresholds=<file>     Fail if a result crosses a threshold\n";
+
+static const char *optionValue(const char *const restrict arg,
+                               const char *const restrict name) {
+  const size_t len = strlen(name);
+  if (strncmp(arg, name, len) == 0 && arg[len] == '=')
+    return arg + len + 1;
+  return NULL;
+}
+
+static bool parseCount(const char *const restrict str, unsigned max,
+                       unsigned *out) {
+  char *end;
+  unsigned long n = strtoul(str, &end, 10);
+  if (end == str || *end || n == 0 || n > max)
+    return false;
+  *out = (unsigned)n;
+  return true;
+}
+
+static bool parseOptions(int argc, char *argv[], Options *out) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  *out = (Options){
+      .runs = 5,
+      .jobs = cpus > 1 ? (unsigned)min(cpus, MAX_JOBS) : 1,
+      .warm = true,
+      .cold = true,
+  };
+  unsigned positional = 0;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value;
+    if ((value = optionValue(arg, "--runs"))) {
+      if (!parseCount(value, MAX_RUNS, &out->runs))
+        return false;
+    } else if ((value = optionValue(arg, "--jobs"))) {
+      if (!parseCount(value, MAX_JOBS, &out->jobs))
+        return false;
+    } else if ((value = optionValue(arg, "--cache"))) {
+      out->warm = strcmp(value, "warm") == 0 || strcmp(value, "both") == 0;
+      out->cold = strcmp(value, "cold") == 0 || strcmp(value, "both") == 0;
+      if (!out->warm && !out->cold)
+        return false;
+    } else if ((value = optionValue(arg, "--thresholds"))) {
+      out->thresholds = value;
+    } else if (strncmp(arg, "--", 2) == 0) {
+      return false;
+    } else if (positional == 0) {
+      out->unbox = arg;
+      positional++;
+    } else if (positional == 1) {
+      out->input_folder = arg;
+      positional++;
+    } else if (positional == 2) {
+      out->output_folder = arg;
+      positional++;
+    } else {
+      return false;
+    }
+  }
+  return positional == 3;
+}
+
+// Drop the frame images from the page cache, so the next run reads them from
+// disk. Only done where the kernel supports it.
+static bool evictFolder(const char *const restrict folder) {
+#ifdef POSIX_FADV_DONTNEED
+  DirIterator it;
+  if (!dir_start(folder, &it))
+    return false;
+  DirEntry ent;
+  char path[4096];
+  while (dir_next(&it, &ent)) {
+    if (ent.name[0] == '.')
+      continue;
+    snprintf(path, sizeof path, "%s/%s", folder, ent.name);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+      continue;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+  dir_end(&it);
+  return true;
+#else
+  (void)folder;
+  return false;
+#endif
+}
+
+// unbox skips files recorded in its resume journal and reuses the control
+// frame and TOC cached by an earlier run of the same reel, every run has to
+// start from scratch
+static bool isRunState(const char *const restrict name) {
+  static const char *const prefixes[] = {"journal_", "control_frame_", "toc_",
+                                         "fingerprint_"};
+  for (size_t i = 0; i < sizeof prefixes / sizeof prefixes[0]; i++)
+    if (strncmp(name, prefixes[i], strlen(prefixes[i])) == 0)
+      return true;
+  return false;
+}
+
+static void removeRunState(const char *const restrict folder) {
+  DirIterator it;
+  if (!dir_start(folder, &it))
+    return;
+  DirEntry ent;
+  char path[4096];
+  while (dir_next(&it, &ent)) {
+    if (!isRunState(ent.name))
+      continue;
+    snprintf(path, sizeof path, "%s/%s", folder, ent.name);
+    unlink(path);
+  }
+  dir_end(&it);
+}
+
+static uint64_t jsonNumber(const char *const restrict json,
+                           const char *const restrict key) {
+  const char *p = strstr(json, key);
+  return p ? strtoull(p + strlen(key), NULL, 10) : 0;
+}
+
+// Reads the frame and byte counts from the --stats=json:<path> report of a
+// finished job
+static bool readJobStats(const char *const restrict path, uint64_t *frames,
+                         uint64_t *bytes) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  char line[4096];
+  const bool found = fgets(line, sizeof line, f) != NULL;
+  if (found) {
+    *frames += jsonNumber(line, "\"frames\":");
+    *bytes += jsonNumber(line, "\"bytes_written\":");
+  }
+  fclose(f);
+  return found;
+}
+
+static bool runOnce(const Options *options, unsigned jobs, RunResult *out) {
+  pid_t pids[MAX_JOBS];
+  char job_folder[MAX_JOBS][4096];
+  char stats_path[MAX_JOBS][4096];
+  for (unsigned j = 0; j < jobs; j++) {
+    snprintf(job_folder[j], sizeof job_folder[j], "%s/job%u",
+             options->output_folder, j);
+    mkdir(job_folder[j], 0755);
+    removeRunState(job_folder[j]);
+    snprintf(stats_path[j], sizeof stats_path[j], "%s/job%u.json",
+             options->output_folder, j);
+  }
+
+  const uint64_t start = clock_now_ns();
+  for (unsigned j = 0; j < jobs; j++) {
+    pid_t pid = fork();
+    if (pid < 0)
+      return false;
+    if (pid == 0) {
+      int fd = open("/dev/null", O_WRONLY);
+      if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0)
+        _exit(127);
+      close(fd);
+      char stats_option[4096 + 16];
+      snprintf(stats_option, sizeof stats_option, "--stats=json:%s",
+               stats_path[j]);
+      // Dedup would skip decoding files repeated in the reel
+      execl(options->unbox, options->unbox, stats_option, "--log-level=error",
+            "--dedup=off", options->input_folder, job_folder[j], (char *)NULL);
+      _exit(127);
+    }
+    pids[j] = pid;
+  }
+
+  bool ok = true;
+  long peak_rss_kb = 0;
+  for (unsigned j = 0; j < jobs; j++) {
+    int status;
+    struct rusage usage;
+    if (wait4(pids[j], &status, 0, &usage) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != EXIT_SUCCESS)
+      ok = false;
+    else if (usage.ru_maxrss > peak_rss_kb)
+      peak_rss_kb = usage.ru_maxrss;
+  }
+  const double wall_s = (double)(clock_now_ns() - start) / 1e9;
+  if (!ok)
+    return false;
+
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  for (unsigned j = 0; j < jobs; j++)
+    if (!readJobStats(stats_path[j], &frames, &bytes))
+      return false;
+#ifdef __APPLE__
+  const double rss_mb = (double)peak_rss_kb / 1e6; // ru_maxrss is in bytes
+#else
+  const double rss_mb = (double)peak_rss_kb * 1024 / 1e6;
+#endif
+  *out = (RunResult){
+      .frames_per_s = wall_s > 0 ? (double)frames / wall_s : 0,
+      .mb_per_s = wall_s > 0 ? (double)bytes / 1e6 / wall_s : 0,
+      .peak_rss_mb = rss_mb,
+  };
+  return true;
+}
+
+static int compareDouble(const void *a, const void *b) {
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+typedef struct {
+  double median;
+  double min;
+  double max;
+} Summary;
+
+static Summary summarize(double *values, unsigned count) {
+  qsort(values, count, sizeof *values, compareDouble);
+  return (Summary){
+      .median = count % 2 ? values[count / 2]
+                          : (values[count / 2 - 1] + values[count / 2]) / 2,
+      .min = values[0],
+      .max = values[count - 1],
+  };
+}
+
+// Threshold file, one rule per line, '#' starts a comment:
+//   <variant> <frames_per_s|mb_per_s|peak_rss_mb> <min|max> <value>
+// The median of the variant is compared against the value.
+static unsigned loadThresholds(const char *const restrict path,
+                               Threshold *out) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  unsigned count = 0;
+  char line[256];
+  while (count < MAX_THRESHOLDS && fgets(line, sizeof line, f)) {
+    char *comment = strchr(line, '#');
+    if (comment)
+      *comment = '\0';
+    char bound[8];
+    Threshold *t = &out[count];
+    if (sscanf(line, "%31s %31s %7s %lf", t->variant, t->metric, bound,
+               &t->value) != 4)
+      continue;
+    t->is_min = strcmp(bound, "min") == 0;
+    count++;
+  }
+  fclose(f);
+  return count;
+}
+
+// Returns the number of thresholds crossed by a variant
+static unsigned checkThresholds(const Threshold *thresholds, unsigned count,
+                                const char *const restrict variant,
+                                const Summary *frames_per_s,
+                                const Summary *mb_per_s,
+                                const Summary *peak_rss_mb) {
+  unsigned failed = 0;
+  for (unsigned i = 0; i < count; i++) {
+    const Threshold *t = &thresholds[i];
+    if (strcmp(t->variant, variant) != 0)
+      continue;
+    const Summary *s = strcmp(t->metric, "frames_per_s") == 0 ? frames_per_s
+                       : strcmp(t->metric, "mb_per_s") == 0   ? mb_per_s
+                       : strcmp(t->metric, "peak_rss_mb") == 0
+                           ? peak_rss_mb
+                           : NULL;
+    if (!s) {
+      fprintf(stderr, "Unknown metric in thresholds: %s\n", t->metric);
+      failed++;
+      continue;
+    }
+    if (t->is_min ? s->median < t->value : s->median > t->value) {
+      fprintf(stderr, "REGRESSION %s %s: %.3f, %s %.3f\n", variant, t->metric,
+              s->median, t->is_min ? "min" : "max", t->value);
+      failed++;
+    }
+  }
+  return failed;
+}
+
+static void printSummary(const char *const restrict name, const Summary *s) {
+  printf("\"%s\":{\"median\":%.3f,\"min\":%.3f,\"max\":%.3f}", name, s->median,
+         s->min, s->max);
+}
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    fprintf(stderr, usage, argv[0]);
+    return EXIT_FAILURE;
+  }
+  mkdir(options.output_folder, 0755);
+
+  Threshold thresholds[MAX_THRESHOLDS];
+  unsigned threshold_count = 0;
+  if (options.thresholds) {
+    threshold_count = loadThresholds(options.thresholds, thresholds);
+    if (!threshold_count)
+      return EXIT_FAILURE;
+  }
+
+  unsigned job_counts[2] = {1, options.jobs};
+  unsigned job_variants = options.jobs > 1 ? 2 : 1;
+  unsigned regressions = 0;
+  bool first = true;
+  printf("{\"runs\":%u,\"variants\":{", options.runs);
+  for (int cold = 0; cold < 2; cold++) {
+    if (cold ? !options.cold : !options.warm)
+      continue;
+    if (cold && !evictFolder(options.input_folder)) {
+      fprintf(stderr, "Cold cache runs are not supported on this system\n");
+      continue;
+    }
+    for (unsigned v = 0; v < job_variants; v++) {
+      const unsigned jobs = job_counts[v];
+      char name[32];
+      snprintf(name, sizeof name, "%s_%s", cold ? "cold" : "warm",
+               jobs > 1 ? "multi" : "single");
+      RunResult warmup;
+      if (!cold && !runOnce(&options, jobs, &warmup)) {
+        fprintf(stderr, "%s: unbox failed\n", name);
+        return EXIT_FAILURE;
+      }
+      double frames_per_s[MAX_RUNS], mb_per_s[MAX_RUNS], rss_mb[MAX_RUNS];
+      for (unsigned r = 0; r < options.runs; r++) {
+        if (cold)
+          evictFolder(options.input_folder);
+        RunResult result;
+        if (!runOnce(&options, jobs, &result)) {
+          fprintf(stderr, "%s: unbox failed\n", name);
+          return EXIT_FAILURE;
+        }
+        frames_per_s[r] = result.frames_per_s;
+        mb_per_s[r] = result.mb_per_s;
+        rss_mb[r] = result.peak_rss_mb;
+      }
+      const Summary fps = summarize(frames_per_s, options.runs);
+      const Summary mbps = summarize(mb_per_s, options.runs);
+      const Summary rss = summarize(rss_mb, options.runs);
+      printf("%s\"%s\":{\"jobs\":%u,", first ? "" : ",", name, jobs);
+      printSummary("frames_per_s", &fps);
+      putchar(',');
+      printSummary("mb_per_s", &mbps);
+      putchar(',');
+      printSummary("peak_rss_mb", &rss);
+      putchar('}');
+      fflush(stdout);
+      first = false;
+      regressions += checkThresholds(thresholds, threshold_count, name, &fps,
+                                     &mbps, &rss);
+    }
+  }
+  printf("},\"regressions\":%u}\n", regressions);
+  return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
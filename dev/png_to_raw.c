@@ -0,0 +1,276 @@
+// Packs a folder of numbered frame images into a .raw reel, the inverse of
+// raw_file_to_png:
+//
+//   png_to_raw [--threads=N] [--depth=auto|1|2|8] <frame folder or tar>
+//              <output .raw>
+//
+// An output of "-" writes the reel to stdout, to pipe it into `unbox -`.
+//
+// Frames are decoded in parallel and written in frame order as records of
+// RawFileHeader, packed pixels and RawFileFooter with a valid CRC64. With
+// --depth=auto (the default) every frame is stored at the smallest bit depth
+// that holds its gray levels exactly, so 1 and 2-bit content stored as 8-bit
+// PNGs shrinks 8 or 4 times without loss. A fixed depth quantizes every frame
+// to 2^depth levels.
+
+#include "../src/crc64.c"
+#include "../src/raw_file.c"
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "../src/reel.c"
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+#include <boxing/math/crc64.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  Slice record; // header, packed pixels and footer, empty if packing failed
+  bool ready;
+} PackedFrame;
+
+// Workers take frames in order and may run up to `window` frames ahead of the
+// writer, which waits on `packed` for the next frame in order. Workers wait on
+// `consumed` for the writer to free a slot.
+typedef struct {
+  Reel *reel;
+  uint16_t *ids;       // frame ids in increasing order
+  uint32_t count;
+  uint32_t next;       // next frame to pack
+  uint32_t written;    // frames taken by the writer
+  uint32_t window;
+  PackedFrame *frames; // ring of `window` slots
+  uint8_t depth;       // 0 for auto
+  Mutex mutex;
+  Cond packed;
+  Cond consumed;
+} PackQueue;
+
+static Crc64 crc64;
+
+static Slice packFrame(const PackQueue *q, const uint16_t id,
+                       ImageArena *arena, dcrc64 *fallback) {
+  // Safe to share between workers, only .raw reels unpack into the Reel
+  Image image = Reel_load_frame_into(q->reel, arena, id);
+  if (!image.data)
+    return Slice_empty;
+  const uint32_t width = (uint32_t)image.width;
+  const uint32_t height = (uint32_t)image.height;
+  const size_t pixels = (size_t)width * height;
+  uint8_t depth = q->depth ? q->depth : detectColorDepth(image.data, pixels);
+  // Packed pixels of a frame have to fill whole bytes
+  if (pixels % (8 / depth) != 0) {
+    if (q->depth) {
+      fprintf(stderr,
+              "%s: frame %" PRIu16 " of %" PRIu32 "x%" PRIu32
+              " can not be packed to %" PRIu8 " bits\n",
+              q->reel->directory_path, id, width, height, depth);
+      return Slice_empty;
+    }
+    depth = 8;
+  }
+
+  RawFileHeader header;
+  memset(&header, 0, sizeof header);
+  header.frame_id = id;
+  header.frame_height = height;
+  header.frame_width = width;
+  header.color_depth = depth;
+  header.version = 1;
+  // Gray levels, 0 standing in for 256
+  header.colors_per_channel = (uint8_t)(1u << depth);
+  const size_t size = raw_frame_record_size(&header);
+  Slice record = {.data = malloc(size), .size = size};
+  if (!record.data)
+    return Slice_empty;
+  uint8_t *const p = (uint8_t *)record.data;
+  memcpy(p, &header, sizeof header);
+  pack_pixels(image.data, width, height, depth, p + sizeof header);
+  RawFileFooter *const footer = (RawFileFooter *)(p + size) - 1;
+  memset(footer, 0, sizeof *footer);
+  const uint64_t crc =
+      crc64_calc(&crc64, fallback, p, size - sizeof footer->crc);
+  raw_set_footer_crc(footer, crc);
+  return record;
+}
+
+static void packWorker(void *arg) {
+  PackQueue *q = arg;
+  // dcrc64 instances are not thread-safe, each worker needs its own
+  dcrc64 *fallback = crc64.ok ? NULL : boxing_math_crc64_create_def();
+  ImageArena arena = {.memory = NULL, .used = 0};
+  mutex_lock(&q->mutex);
+  for (;;) {
+    while (q->next < q->count && q->next - q->written >= q->window)
+      cond_wait(&q->consumed, &q->mutex);
+    if (q->next >= q->count)
+      break;
+    const uint32_t i = q->next++;
+    mutex_unlock(&q->mutex);
+
+    Slice record = crc64.ok || fallback
+                       ? packFrame(q, q->ids[i], &arena, fallback)
+                       : Slice_empty;
+
+    mutex_lock(&q->mutex);
+    q->frames[i % q->window] = (PackedFrame){.record = record, .ready = true};
+    cond_broadcast(&q->packed);
+  }
+  mutex_unlock(&q->mutex);
+  if (fallback)
+    boxing_math_crc64_free(fallback);
+  image_deinit(&arena);
+}
+
+static const char *optionValue(const char *const restrict arg,
+                               const char *const restrict name) {
+  const size_t len = strlen(name);
+  if (strncmp(arg, name, len) == 0 && arg[len] == '=')
+    return arg + len + 1;
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned thread_count = cpu_count();
+  uint8_t depth = 0;
+  const char *paths[2] = {NULL, NULL};
+  unsigned path_count = 0;
+  bool bad_arguments = false;
+  for (int i = 1; i < argc; i++) {
+    const char *value;
+    if ((value = optionValue(argv[i], "--threads"))) {
+      thread_count = (unsigned)strtoul(value, NULL, 10);
+      bad_arguments = bad_arguments || !thread_count || thread_count > 1024;
+    } else if ((value = optionValue(argv[i], "--depth"))) {
+      depth = strcmp(value, "auto") == 0 ? 0 : (uint8_t)atoi(value);
+      bad_arguments = bad_arguments ||
+                      (strcmp(value, "auto") != 0 && depth != 1 &&
+                       depth != 2 && depth != 8);
+    } else if (path_count < countof(paths) && strncmp(argv[i], "--", 2) != 0) {
+      paths[path_count++] = argv[i];
+    } else {
+      bad_arguments = true;
+    }
+  }
+  if (bad_arguments || path_count != countof(paths)) {
+    fprintf(stderr,
+            "Usage: %s [--threads=N] [--depth=auto|1|2|8] "
+            "<frame folder or tar> <output .raw or - for stdout>\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // Workers decode into arenas of their own
+  Reel *reel = Reel_create(NULL);
+  if (!reel || !Reel_init(reel, paths[0]) ||
+      reel->source == ReelRaw || reel->source == ReelStream) {
+    fprintf(stderr, "%s: no numbered frames\n", paths[0]);
+    if (reel)
+      Reel_destroy(reel);
+    return EXIT_FAILURE;
+  }
+  if (!crc64_init(&crc64))
+    fprintf(stderr, "Fast CRC64 does not match the library, using the "
+                    "library's\n");
+
+  PackQueue q = {
+      .reel = reel,
+      .ids = malloc(reel->count * sizeof *q.ids),
+      .count = 0,
+      .next = 0,
+      .written = 0,
+      .window = 2 * thread_count,
+      .frames = calloc(2 * thread_count, sizeof *q.frames),
+      .depth = depth,
+  };
+  const bool to_stdout = strcmp(paths[1], "-") == 0;
+#ifdef _WIN32
+  if (to_stdout)
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  FILE *out = to_stdout ? stdout : fopen(paths[1], "wb");
+  bool ok = q.ids && q.frames && out;
+  if (!out)
+    fprintf(stderr, "%s: failed to open\n", paths[1]);
+  for (uint32_t id = 0; ok && id < countof(reel->frames); id++)
+    if (reel->frames[id])
+      q.ids[q.count++] = (uint16_t)id;
+  mutex_init(&q.mutex);
+  cond_init(&q.packed);
+  cond_init(&q.consumed);
+
+  Thread *threads = malloc(thread_count * sizeof *threads);
+  unsigned threads_started = 0;
+  while (ok && threads && threads_started < thread_count &&
+         thread_start(&threads[threads_started], packWorker, &q))
+    threads_started++;
+  if (ok && !threads_started) {
+    fprintf(stderr, "Failed to create thread\n");
+    ok = false;
+  }
+
+  uint32_t depth_counts[9] = {0};
+  uint64_t bytes = 0;
+  for (uint32_t i = 0; ok && i < q.count; i++) {
+    PackedFrame *const slot = &q.frames[i % q.window];
+    mutex_lock(&q.mutex);
+    while (!slot->ready)
+      cond_wait(&q.packed, &q.mutex);
+    const Slice record = slot->record;
+    slot->ready = false;
+    q.written++;
+    cond_broadcast(&q.consumed);
+    mutex_unlock(&q.mutex);
+
+    if (!record.data) {
+      fprintf(stderr, "Failed to pack frame %" PRIu16 "\n", q.ids[i]);
+      ok = false;
+    } else if (fwrite(record.data, record.size, 1, out) != 1) {
+      fprintf(stderr, "%s: failed to write frame %" PRIu16 "\n", paths[1],
+              q.ids[i]);
+      ok = false;
+    } else {
+      depth_counts[((const RawFileHeader *)record.data)->color_depth]++;
+      bytes += record.size;
+    }
+    free(record.data);
+  }
+
+  // Stop the workers early on failure
+  mutex_lock(&q.mutex);
+  q.next = q.count;
+  cond_broadcast(&q.consumed);
+  mutex_unlock(&q.mutex);
+  for (unsigned t = 0; t < threads_started; t++)
+    thread_join(threads[t]);
+  for (uint32_t s = 0; q.frames && s < q.window; s++)
+    if (q.frames[s].ready)
+      free(q.frames[s].record.data);
+
+  if (out && fclose(out) != 0)
+    ok = false;
+  if (ok) {
+    // The reel itself may be on stdout
+    fprintf(to_stdout ? stderr : stdout,
+            "%" PRIu32 " frames (%" PRIu32 " 1-bit, %" PRIu32 " 2-bit, %" PRIu32
+            " 8-bit), %" PRIu64 " bytes\n",
+            q.count, depth_counts[1], depth_counts[2], depth_counts[8], bytes);
+  } else if (out && !to_stdout) {
+    remove(paths[1]);
+  }
+  cond_destroy(&q.consumed);
+  cond_destroy(&q.packed);
+  mutex_destroy(&q.mutex);
+  free(threads);
+  free(q.frames);
+  free(q.ids);
+  Reel_destroy(reel);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
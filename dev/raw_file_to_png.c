@@ -1,74 +1,74 @@
 #include "../dep/afs/unboxing/inc/boxing/math/crc64.h"
+#include "../src/copy_range.c"
+#include "../src/crc64.c"
 #include "../src/grow.c"
 #include "../src/map_file.c"
+#include "../src/png_write.c"
 #include "../src/unboxing_log.c"
 #ifdef _WIN32
 #include "../src/win32.h"
-#define BYTE_ORDER 1234
-#define LITTLE_ENDIAN 1234
-#elif defined(__APPLE__)
-#else
-#include <endian.h>
 #endif
+#include <errno.h>
 #include <inttypes.h>
-#ifndef _WIN32
-#include <pthread.h>
-#endif
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
-#define THREADED
-#ifdef THREADED
-#define THREAD_COUNT 6
-#endif
-
-#include "raw_file.c"
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "../dep/stb/stb_image_write.h"
+#include "../src/raw_index.c"
 
+// Header, data and footer of a frame are contiguous in the reel and are
+// copied as one record, by the kernel where it can (see copy_range) and from
+// the mapped reel otherwise. Only a record that starts on a block boundary
+// shares blocks with the reel, in a packed reel that is just the first one.
 static bool generateFrameRaw(const char *const restrict output_path,
-                             const RawFileHeader *const restrict header_data,
-                             const uint8_t *const restrict data,
-                             const size_t data_size,
-                             const RawFileFooter *const restrict footer_data) {
+                             const RawFileHeader *const restrict record,
+                             const int reel_fd, const uint64_t offset) {
+  const size_t size = raw_frame_record_size(record);
 #ifdef _WIN32
+  (void)reel_fd;
+  (void)offset;
   uint32_t attr = GetFileAttributesA(output_path);
   if (attr != INVALID_FILE_ATTRIBUTES && !(attr & FILE_ATTRIBUTE_DIRECTORY))
     return true;
+  FILE *fd = fopen(output_path, "wb");
+  if (!fd)
+    return false;
+  bool ok = fwrite(record, 1, size, fd) == size;
+  ok = fclose(fd) == 0 && ok;
 #else
   struct stat s;
   if (stat(output_path, &s) == 0)
     return true;
-#endif
-  FILE *fd = fopen(output_path, "w");
-  if (!fd)
-    return false;
-  if (fwrite(header_data, sizeof *header_data, 1, fd) != 1) {
-    fprintf(stderr, "%s: failed to write header data\n", output_path);
-    fclose(fd);
+  int fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
     return false;
-  };
-  if (fwrite(data, 1, data_size, fd) != data_size) {
-    fprintf(stderr, "%s: failed to write frame data\n", output_path);
-    fclose(fd);
-    return false;
-  };
-  if (fwrite(footer_data, sizeof *footer_data, 1, fd) != 1) {
-    fprintf(stderr, "%s: failed to write footer data\n", output_path);
-    fclose(fd);
-    return false;
-  };
-  fclose(fd);
-  return true;
+  size_t done = reel_fd != -1 ? copy_range(fd, reel_fd, offset, size) : 0;
+  while (done < size) {
+    const ssize_t n = pwrite(fd, (const uint8_t *)record + done, size - done,
+                             (off_t)done);
+    if (n > 0)
+      done += (size_t)n;
+    else if (n == 0 || errno != EINTR)
+      break;
+  }
+  bool ok = done == size;
+  ok = close(fd) == 0 && ok;
+#endif
+  if (!ok) {
+    fprintf(stderr, "%s: failed to write frame\n", output_path);
+    remove(output_path);
+  }
+  return ok;
 }
 
 static bool generateFramePng(const char *const restrict output_path,
                              const uint8_t *const restrict data,
                              const uint32_t width, const uint32_t height,
                              const uint8_t color_depth,
-                             Slice *const output_image) {
+                             const bool native_depth,
+                             const PngProfile profile,
+                             Slice *const output_image,
+                             Slice *const scanlines) {
 #ifdef _WIN32
   uint32_t attr = GetFileAttributesA(output_path);
   if (attr != INVALID_FILE_ATTRIBUTES && !(attr & FILE_ATTRIBUTE_DIRECTORY))
@@ -79,18 +79,28 @@ static bool generateFramePng(const char *const restrict output_path,
     return true;
 #endif
 
-  if (color_depth == 8)
-    return stbi_write_png(output_path, width, height, 1, data, width) != 0;
+  if (native_depth && color_depth != 8 &&
+      png_native_depth_supported(width, color_depth))
+    return png_write_gray(output_path, data, width, height, color_depth,
+                          profile, scanlines);
 
-  if (!splat_pixels(data, width, height, color_depth, output_image))
-    return false;
+  const uint8_t *pixels = data;
+  if (color_depth != 8) {
+    if (!splat_pixels(data, width, height, color_depth, output_image))
+      return false;
+    pixels = output_image->data;
+  }
 
-  return stbi_write_png(output_path, width, height, 1, output_image->data,
-                        width) != 0;
+  if (profile != PngDefault && png_native_depth_supported(width, 8))
+    return png_write_gray(output_path, pixels, width, height, 8, profile,
+                          scanlines);
+  return stbi_write_png(output_path, width, height, 1, pixels, width) != 0;
 }
 
 typedef struct {
   char output_path[256];
+  uint32_t index;  // position of the frame in the reel
+  uint64_t offset; // of the frame record in the reel
   uint16_t frame_id;
   const RawFileHeader *header_data;
   const uint8_t *frame_data;
@@ -100,6 +110,19 @@ typedef struct {
   uint8_t color_depth;
 } FrameGenerationJob;
 
+static Crc64 crc64;
+
+// CRC64 of a frame record as stored in its footer: header, data and the footer
+// up to the CRC itself
+static uint64_t frameChecksum(const FrameGenerationJob *job, dcrc64 *fallback) {
+  return crc64_calc(&crc64, fallback, job->header_data,
+                    raw_frame_record_size(job->header_data) - 8);
+}
+
+// Jobs are queued by the main thread and taken in batches by a pool of
+// worker threads that lives across all input reels. Idle workers block on
+// `work_available`, the main thread waits on `idle` for a reel to drain before
+// unmapping it.
 typedef struct {
   enum JobKind {
     JOB_GENERATE_PNG,
@@ -108,117 +131,166 @@ typedef struct {
     JOB_GENERATE_VALIDATE,
   } job;
   Slice jobs;
-  uint16_t count;
-  uint16_t offset;
-  bool done;
-#ifdef THREADED
-#ifdef _WIN32
-  void *mutex;
-#else
-  pthread_mutex_t mutex;
-#endif
-#endif
+  uint32_t count;
+  uint32_t offset;
+  uint32_t in_flight;  // taken by a worker, not finished yet
+  uint64_t *checksums; // computed CRC64 of every frame, when validating
+  bool native_depth;   // write 1 and 2-bit frames as 1 and 2-bit PNGs
+  PngProfile png_profile;
+  int reel_fd; // reel being split, -1 if it could not be opened
+  bool done;           // no more jobs will be queued, workers exit
+  Mutex mutex;
+  Cond work_available;
+  Cond idle;
 } PendingFrameGenerationJobList;
 
-#ifdef _WIN32
-uint32_t WINAPI frameGeneratorWorker(PendingFrameGenerationJobList *job_list) {
-#else
-void *frameGeneratorWorker(PendingFrameGenerationJobList *job_list) {
-#endif
+static void frameGeneratorWorker(void *arg) {
+  PendingFrameGenerationJobList *job_list = arg;
   // Reasonable initial guess for size
   Slice output_image = {
       .data = malloc(4096 * 2160),
       .size = 4096 * 2160,
   };
+  Slice scanlines = Slice_empty;
+  // dcrc64 instances are not thread-safe, each worker needs its own
+  dcrc64 *fallback_crc = NULL;
+  if (job_list->job == JOB_GENERATE_VALIDATE && !crc64.ok)
+    fallback_crc = boxing_math_crc64_create_def();
 
+  mutex_lock(&job_list->mutex);
   for (;;) {
-#ifdef THREADED
-#ifdef _WIN32
-    if (WaitForSingleObject(job_list->mutex, 0) == WAIT_OBJECT_0) {
-#else
-    if (pthread_mutex_trylock(&job_list->mutex) == 0) {
-#endif
-#endif
-      if (job_list->offset >= job_list->count) {
-        bool done = job_list->done;
-#ifdef THREADED
-#ifdef _WIN32
-        ReleaseMutex(job_list->mutex);
-#else
-        pthread_mutex_unlock(&job_list->mutex);
-#endif
-#endif
-        if (done) {
-          free(output_image.data);
-#ifdef _WIN32
-          return 0;
-#else
-        return NULL;
-#endif
-        } else
-          continue;
+    while (job_list->offset >= job_list->count && !job_list->done)
+      cond_wait(&job_list->work_available, &job_list->mutex);
+    if (job_list->offset >= job_list->count)
+      break;
+
+    enum JobKind activeJob = job_list->job;
+
+    FrameGenerationJob jobs[16];
+    uint32_t jobs_left = job_list->count - job_list->offset;
+    uint8_t count = (uint8_t)min(countof(jobs), jobs_left);
+    memcpy(jobs, (FrameGenerationJob *)job_list->jobs.data + job_list->offset,
+           sizeof *jobs * count);
+    job_list->offset += count;
+    job_list->in_flight += count;
+    mutex_unlock(&job_list->mutex);
+
+    bool ok = true;
+    if (activeJob == JOB_GENERATE_VALIDATE) {
+      for (uint8_t j = 0; j < count; j++)
+        job_list->checksums[jobs[j].index] =
+            frameChecksum(&jobs[j], fallback_crc);
+    } else if (activeJob == JOB_GENERATE_PNG) {
+      for (uint8_t j = 0; j < count; j++) {
+        ok = ok && generateFramePng(jobs[j].output_path, jobs[j].frame_data,
+                                    jobs[j].width, jobs[j].height,
+                                    jobs[j].color_depth,
+                                    job_list->native_depth,
+                                    job_list->png_profile, &output_image,
+                                    &scanlines);
       }
-
-      enum JobKind activeJob = job_list->job;
-
-      FrameGenerationJob jobs[16];
-      uint16_t jobs_left = job_list->count - job_list->offset;
-      uint8_t count = (uint8_t)min(countof(jobs), jobs_left);
-      memcpy(jobs, (FrameGenerationJob *)job_list->jobs.data + job_list->offset,
-             sizeof *jobs * count);
-      job_list->offset += count;
-#ifdef THREADED
-#ifdef _WIN32
-      ReleaseMutex(job_list->mutex);
-#else
-      pthread_mutex_unlock(&job_list->mutex);
-#endif
-#endif
-      bool ok = true;
-      if (activeJob == JOB_GENERATE_PNG) {
-        for (uint8_t j = 0; j < count; j++) {
-          ok = ok && generateFramePng(jobs[j].output_path, jobs[j].frame_data,
-                                      jobs[j].width, jobs[j].height,
-                                      jobs[j].color_depth, &output_image);
-        }
-      } else if (activeJob == JOB_GENERATE_SINGLE) {
-        for (uint8_t j = 0; j < count; j++) {
-          size_t frame_size = jobs[j].width * jobs[j].height;
-          if (jobs[j].color_depth == 1)
-            frame_size >>= 3;
-          else if (jobs[j].color_depth == 2)
-            frame_size >>= 2;
-          else
-            assert(jobs[j].color_depth == 8);
-          ok = ok && generateFrameRaw(jobs[j].output_path, jobs[j].header_data,
-                                      jobs[j].frame_data, frame_size,
-                                      jobs[j].footer_data);
-        }
+    } else if (activeJob == JOB_GENERATE_SINGLE) {
+      for (uint8_t j = 0; j < count; j++) {
+        ok = ok && generateFrameRaw(jobs[j].output_path, jobs[j].header_data,
+                                    job_list->reel_fd, jobs[j].offset);
       }
+    }
+    if (activeJob != JOB_GENERATE_VALIDATE) {
       char status[256];
-      int len =
-          snprintf(status, sizeof status, "%u...%u (%u) (jobs left: %u): %s\n",
-                   jobs[0].frame_id, jobs[count - 1].frame_id, count,
-                   jobs_left - count, ok ? "OK" : "FAIL");
+      int len = snprintf(status, sizeof status,
+                         "%u...%u (%u) (jobs left: %u): %s\n",
+                         jobs[0].frame_id, jobs[count - 1].frame_id, count,
+                         jobs_left - count, ok ? "OK" : "FAIL");
       fwrite(status, 1, len, stdout);
-#ifdef THREADED
     }
-#endif
+
+    mutex_lock(&job_list->mutex);
+    job_list->in_flight -= count;
+    if (job_list->offset >= job_list->count && !job_list->in_flight)
+      cond_broadcast(&job_list->idle);
+  }
+  mutex_unlock(&job_list->mutex);
+  if (fallback_crc)
+    boxing_math_crc64_free(fallback_crc);
+  free(output_image.data);
+  free(scanlines.data);
+}
+
+static bool pushJob(PendingFrameGenerationJobList *job_list,
+                    const FrameGenerationJob *job) {
+  mutex_lock(&job_list->mutex);
+  bool ok = grow(&job_list->jobs.data, sizeof *job, &job_list->jobs.size,
+                 job_list->count + 1);
+  if (ok) {
+    ((FrameGenerationJob *)job_list->jobs.data)[job_list->count++] = *job;
+    cond_signal(&job_list->work_available);
   }
+  mutex_unlock(&job_list->mutex);
+  return ok;
+}
+
+// Blocks until every queued job is finished, then empties the queue
+static void waitForJobs(PendingFrameGenerationJobList *job_list) {
+  mutex_lock(&job_list->mutex);
+  while (job_list->offset < job_list->count || job_list->in_flight)
+    cond_wait(&job_list->idle, &job_list->mutex);
+  job_list->count = 0;
+  job_list->offset = 0;
+  mutex_unlock(&job_list->mutex);
+}
+
+static const char *optionValue(const char *const restrict arg,
+                               const char *const restrict name) {
+  const size_t len = strlen(name);
+  if (strncmp(arg, name, len) == 0 && arg[len] == '=')
+    return arg + len + 1;
+  return NULL;
 }
 
 // void setup_debug_handlers(void);
 
 int main(int argc, char *argv[]) {
   // setup_debug_handlers();
+  unsigned thread_count = cpu_count();
+  bool native_depth = false;
+  PngProfile png_profile = PngDefault;
+  int kept = 1;
+  for (int i = 1; i < argc; i++) {
+    const char *value;
+    if (strcmp(argv[i], "--native-depth") == 0) {
+      native_depth = true;
+      continue;
+    }
+    if ((value = optionValue(argv[i], "--png"))) {
+      if (!png_parse_profile(value, &png_profile)) {
+        fprintf(stderr, "Invalid PNG profile: %s\n", value);
+        return EXIT_FAILURE;
+      }
+      continue;
+    }
+    value = optionValue(argv[i], "--threads");
+    if (!value) {
+      argv[kept++] = argv[i];
+      continue;
+    }
+    char *end;
+    unsigned long n = strtoul(value, &end, 10);
+    if (end == value || *end || n == 0 || n > 1024) {
+      fprintf(stderr, "Invalid thread count: %s\n", value);
+      return EXIT_FAILURE;
+    }
+    thread_count = (unsigned)n;
+  }
+  argc = kept;
   if (argc < 3) {
-    fprintf(stderr, "Usage: %s <input file(s) (.raw)> <output folder path>\n",
+    fprintf(stderr,
+            "Usage: %s [--threads=N] [--native-depth] "
+            "[--png=default|fast|store] <input file(s) (.raw)> <output folder "
+            "path> [split|read|validate]\n",
             argv[0]);
     return EXIT_FAILURE;
   }
 
-  dcrc64 *crc = boxing_math_crc64_create_def();
-
   enum JobKind job_kind =
       (argc >= 4
            ? (strcmp(argv[argc - 1], "split") == 0      ? JOB_GENERATE_SINGLE
@@ -231,49 +303,39 @@ int main(int argc, char *argv[]) {
       .jobs = {.data = NULL, .size = 0},
       .count = 0,
       .offset = 0,
+      .in_flight = 0,
+      .checksums = NULL,
+      .native_depth = native_depth,
+      .png_profile = png_profile,
+      .reel_fd = -1,
       .done = false,
-#ifdef THREADED
-#ifdef _WIN32
-      .mutex = CreateMutexA(NULL, FALSE, NULL),
-#else
-      .mutex = PTHREAD_MUTEX_INITIALIZER,
-#endif
-#endif
   };
+  mutex_init(&job_list.mutex);
+  cond_init(&job_list.work_available);
+  cond_init(&job_list.idle);
+
+  // Reading happens on the main thread
+  if (job_kind == JOB_GENERATE_READ)
+    thread_count = 0;
+  if (job_kind == JOB_GENERATE_VALIDATE && !crc64_init(&crc64))
+    fprintf(stderr, "Fast CRC64 does not match the library, using the "
+                    "library's\n");
+  Thread *threads = malloc((thread_count + 1) * sizeof *threads);
+  unsigned threads_started = 0;
+  while (threads && threads_started < thread_count &&
+         thread_start(&threads[threads_started], frameGeneratorWorker,
+                      &job_list))
+    threads_started++;
+  int status = EXIT_SUCCESS;
+  if (threads_started < thread_count) {
+    fprintf(stderr, "Failed to create thread\n");
+    status = EXIT_FAILURE;
+  }
 
   for (size_t in_file_idx = 1;
+       status == EXIT_SUCCESS &&
        in_file_idx < (size_t)argc - (job_kind == JOB_GENERATE_PNG ? 1 : 2);
        in_file_idx++) {
-#ifdef THREADED
-#ifdef _WIN32
-    void *threads[THREAD_COUNT];
-    for (unsigned i = 0; i < THREAD_COUNT; i++) {
-      void *thread = CreateThread(
-          NULL, 0, (LPTHREAD_START_ROUTINE)frameGeneratorWorker, NULL, 0, NULL);
-      if (thread == NULL) {
-        fprintf(stderr, "Failed to create thread\n");
-        if (job_list.jobs.data)
-          free(job_list.jobs.data);
-        boxing_math_crc64_free(crc);
-        return EXIT_FAILURE;
-      }
-      threads[i] = thread;
-    }
-#else
-    pthread_t threads[THREAD_COUNT];
-    for (unsigned i = 0; i < THREAD_COUNT; i++) {
-      if (pthread_create(&threads[i], NULL,
-                         (void *(*)(void *))frameGeneratorWorker, &job_list)) {
-        fprintf(stderr, "Failed to create thread\n");
-        if (job_list.jobs.data)
-          free(job_list.jobs.data);
-        boxing_math_crc64_free(crc);
-        return EXIT_FAILURE;
-      }
-    }
-#endif
-#endif
-
     const char *folder_path =
         argv[argc - (job_kind == JOB_GENERATE_PNG ? 1 : 2)];
 
@@ -282,113 +344,91 @@ int main(int argc, char *argv[]) {
     const char *input_file = argv[in_file_idx];
 
     const Slice reel = mapFile(input_file);
+    RawIndex index;
+    if (!reel.data || !RawIndex_open(&index, input_file, reel)) {
+      fprintf(stderr, "%s: not a valid .raw reel\n", input_file);
+      if (reel.data)
+        unmapFile(reel);
+      status = EXIT_FAILURE;
+      break;
+    }
 
-    const uint8_t *const ptr = (const uint8_t *)reel.data;
-    size_t i = 0;
-    while (i < reel.size) {
-      const RawFileHeader *const header = (const RawFileHeader *)(ptr + i);
-      i += sizeof *header;
-      const uint8_t *const data = ptr + i;
-      if (header->color_depth == 1)
-        i += (header->frame_height * header->frame_width) / 8;
-      else if (header->color_depth == 2)
-        i += (header->frame_height * header->frame_width) / 4;
-      else if (header->color_depth == 8)
-        i += (header->frame_height * header->frame_width);
-      else {
-        fprintf(stderr, "Invalid color depth: %" PRIu8 "\n",
-                header->color_depth);
-        if (job_list.jobs.data)
-          free(job_list.jobs.data);
+    if (job_kind == JOB_GENERATE_VALIDATE) {
+      job_list.checksums =
+          malloc(max(index.count, 1) * sizeof *job_list.checksums);
+      if (!job_list.checksums) {
+        fprintf(stderr, "OOM\n");
+        RawIndex_close(&index);
         unmapFile(reel);
-        boxing_math_crc64_free(crc);
-        return EXIT_FAILURE;
+        status = EXIT_FAILURE;
+        break;
       }
-      const RawFileFooter *const footer = (const RawFileFooter *)(ptr + i);
-      i += sizeof *footer;
+    }
 
-      if (job_kind == JOB_GENERATE_READ || job_kind == JOB_GENERATE_VALIDATE) {
+#ifndef _WIN32
+    if (job_kind == JOB_GENERATE_SINGLE)
+      job_list.reel_fd = open(input_file, O_RDONLY);
+#endif
 
+    const uint8_t *const ptr = (const uint8_t *)reel.data;
+    size_t i = 0;
+    for (uint32_t e = 0; e < index.count; e++) {
+      const RawFileHeader *const header =
+          (const RawFileHeader *)(ptr + index.entries[e].offset);
+      const uint8_t *const data = (const uint8_t *)(header + 1);
+      i = (size_t)index.entries[e].offset + raw_frame_record_size(header);
+      const RawFileFooter *const footer =
+          (const RawFileFooter *)(ptr + i - sizeof *footer);
+
+      if (job_kind == JOB_GENERATE_READ) {
         printHeader(header);
         fwrite(" ", 1, 1, stdout);
         printFooter(footer);
-        if (job_kind != JOB_GENERATE_VALIDATE)
-          fwrite("\n", 1, 1, stdout);
-      }
-
-      if (job_kind == JOB_GENERATE_VALIDATE) {
-        size_t frame_size = header->frame_width * header->frame_height;
-        if (header->color_depth == 1)
-          frame_size >>= 3;
-        else if (header->color_depth == 2)
-          frame_size >>= 2;
-        else
-          assert(header->color_depth == 8);
-        boxing_math_crc64_calc_crc(crc, (const char *)header,
-                                   sizeof *header + frame_size +
-                                       (unsigned)(sizeof *footer - 8));
-        uint64_t checksum = boxing_math_crc64_get_crc(crc);
-
-        boxing_math_crc64_reset(crc, 0);
-        uint64_t checksum_from_file;
-        memcpy(&checksum_from_file, &footer->crc, sizeof checksum_from_file);
-        bool eq = checksum_from_file ==
-#if BYTE_ORDER == LITTLE_ENDIAN
-#ifdef _WIN32
-                  _byteswap_uint64(checksum)
-#else
-                  __builtin_bswap64(checksum)
-#endif
-#else
-                  checksum
-#endif
-            ;
-        printf("\x1b[%dm %s= %016" PRIx64 "\x1b[0m\n", eq ? 92 : 91,
-               eq ? "=" : "!", checksum);
-      } else if (job_kind != JOB_GENERATE_READ) {
-
-#ifdef THREADED
-#ifdef _WIN32
-        WaitForSingleObject(job_list.mutex, INFINITE);
-#else
-        pthread_mutex_lock(&job_list.mutex);
-#endif
-#endif
-        if (!grow(&job_list.jobs.data, sizeof(FrameGenerationJob),
-                  &job_list.jobs.size, job_list.count + 1)) {
-#ifdef THREADED
-#ifdef _WIN32
-          ReleaseMutex(job_list.mutex);
-#else
-          pthread_mutex_unlock(&job_list.mutex);
-#endif
-#endif
-          fprintf(stderr, "OOM\n");
-          return EXIT_FAILURE;
-        }
-        FrameGenerationJob *job =
-            (FrameGenerationJob *)(job_list.jobs.data) + job_list.count++;
-        snprintf(job->output_path, sizeof job->output_path,
+        fwrite("\n", 1, 1, stdout);
+      } else {
+        FrameGenerationJob job;
+        job.index = e;
+        job.offset = index.entries[e].offset;
+        snprintf(job.output_path, sizeof job.output_path,
                  "%s/%05" PRIu64 ".%s", folder_path, header->frame_id,
                  job_kind == JOB_GENERATE_PNG ? "png" : "raw");
-        job->frame_id = (uint16_t)header->frame_id;
-        job->header_data = header;
-        job->frame_data = data;
-        job->footer_data = footer;
-        job->width = header->frame_width;
-        job->height = header->frame_height;
-        job->color_depth = header->color_depth;
-#ifdef THREADED
-#ifdef _WIN32
-        ReleaseMutex(job_list.mutex);
-#else
-        pthread_mutex_unlock(&job_list.mutex);
-#endif
-#endif
+        job.frame_id = (uint16_t)header->frame_id;
+        job.header_data = header;
+        job.frame_data = data;
+        job.footer_data = footer;
+        job.width = header->frame_width;
+        job.height = header->frame_height;
+        job.color_depth = header->color_depth;
+        if (!pushJob(&job_list, &job)) {
+          fprintf(stderr, "OOM\n");
+          status = EXIT_FAILURE;
+          break;
+        }
       }
     }
 
+    // Jobs point into the mapped reel
+    waitForJobs(&job_list);
+
     if (job_kind == JOB_GENERATE_VALIDATE) {
+      // Checksums are computed in parallel and reported in reel order
+      for (uint32_t e = 0; status == EXIT_SUCCESS && e < index.count; e++) {
+        const RawFileHeader *const header =
+            (const RawFileHeader *)(ptr + index.entries[e].offset);
+        const RawFileFooter *const footer =
+            (const RawFileFooter *)((const uint8_t *)header +
+                                    raw_frame_record_size(header)) -
+            1;
+        const uint64_t checksum = job_list.checksums[e];
+        bool eq = raw_footer_crc(footer) == checksum;
+        printHeader(header);
+        fwrite(" ", 1, 1, stdout);
+        printFooter(footer);
+        printf("\x1b[%dm %s= %016" PRIx64 "\x1b[0m\n", eq ? 92 : 91,
+               eq ? "=" : "!", checksum);
+      }
+      free(job_list.checksums);
+      job_list.checksums = NULL;
       if (i == reel.size) {
         printf("\x1b[92mFILE SIZE OK\x1b[0m\n");
       } else {
@@ -397,38 +437,28 @@ int main(int argc, char *argv[]) {
                reel.size, i);
       }
     }
-#ifdef THREADED
-#ifdef _WIN32
-    WaitForSingleObject(job_list.mutex, INFINITE);
-#else
-    pthread_mutex_lock(&job_list.mutex);
-#endif
-#endif
-    job_list.done = true;
-#ifdef THREADED
-#ifdef _WIN32
-    ReleaseMutex(job_list.mutex);
-#else
-    pthread_mutex_unlock(&job_list.mutex);
-#endif
-#endif
-
-#ifdef THREADED
-#ifdef _WIN32
-    WaitForMultipleObjects(THREAD_COUNT, threads, TRUE, INFINITE);
-#else
-    for (unsigned i = 0; i < THREAD_COUNT; i++)
-      pthread_join(threads[i], NULL);
-#endif
-#else
-    frameGeneratorWorker(&job_list);
+#ifndef _WIN32
+    if (job_list.reel_fd != -1)
+      close(job_list.reel_fd);
+    job_list.reel_fd = -1;
 #endif
+    RawIndex_close(&index);
     unmapFile(reel);
   }
 
+  mutex_lock(&job_list.mutex);
+  job_list.done = true;
+  cond_broadcast(&job_list.work_available);
+  mutex_unlock(&job_list.mutex);
+  for (unsigned t = 0; t < threads_started; t++)
+    thread_join(threads[t]);
+  free(threads);
+  cond_destroy(&job_list.idle);
+  cond_destroy(&job_list.work_available);
+  mutex_destroy(&job_list.mutex);
+
   fflush(stdout);
   if (job_list.jobs.data)
     free(job_list.jobs.data);
-  boxing_math_crc64_free(crc);
-  return EXIT_SUCCESS;
+  return status;
 }
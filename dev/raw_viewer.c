@@ -4,7 +4,7 @@
 
 #include "../src/grow.c"
 #include "../src/map_file.c"
-#include "raw_file.c"
+#include "../src/raw_index.c"
 
 int main(int argc, char **argv) {
   (void)printHeader;
@@ -20,36 +20,19 @@ int main(int argc, char **argv) {
       .data = malloc(image_width * image_height),
       .size = image_width * image_height,
   };
-  Slice positions = {0};
-  size_t positions_cap = 0;
   size_t current_position = 0;
   Slice file = {0};
+  RawIndex index = {0};
   if (argc > 1) {
     file = mapFile(argv[1]);
-  }
-  const uint8_t *const ptr = (const uint8_t *)file.data;
-  size_t i = 0;
-  while (i < file.size) {
-    const RawFileHeader *const header = (const RawFileHeader *)(ptr + i);
-    size_t position = (size_t)header;
-    grow(&positions.data, sizeof position, &positions_cap, positions.size + 1);
-    ((size_t *)positions.data)[positions.size++] = position;
-    i += sizeof *header;
-    if (header->color_depth == 1)
-      i += (header->frame_width * header->frame_height) / 8;
-    else if (header->color_depth == 2)
-      i += (header->frame_width * header->frame_height) / 4;
-    else if (header->color_depth == 8)
-      i += (header->frame_width * header->frame_height);
-    else {
-      fprintf(stderr, "Invalid color depth\n");
+    if (file.data && !RawIndex_open(&index, argv[1], file)) {
+      fprintf(stderr, "Failed to index %s\n", argv[1]);
       unmapFile(file);
-      free(positions.data);
       free(image.data);
       return EXIT_FAILURE;
     }
-    i += sizeof(RawFileFooter);
   }
+  const uint8_t *const ptr = (const uint8_t *)file.data;
   SetTraceLogLevel(LOG_ERROR);
   SetConfigFlags(FLAG_WINDOW_RESIZABLE);
   char title[1024];
@@ -76,8 +59,8 @@ int main(int argc, char **argv) {
   if (!IsShaderValid(invertShader)) {
     fprintf(stderr, "Failed to load shader\n");
     CloseWindow();
+    RawIndex_close(&index);
     unmapFile(file);
-    free(positions.data);
     free(image.data);
     return EXIT_FAILURE;
   }
@@ -126,7 +109,7 @@ int main(int argc, char **argv) {
         user_quit = true;
       else if (k == KEY_LEFT && next_position > 0)
         next_position--;
-      else if (k == KEY_RIGHT && next_position + 1 < positions.size)
+      else if (k == KEY_RIGHT && next_position + 1 < index.count)
         next_position++;
       else if (k == KEY_BACKSPACE && search_idx != 0)
         search[--search_idx] = '\0';
@@ -135,7 +118,7 @@ int main(int argc, char **argv) {
         size_t entered_pos = (size_t)strtoul(search, NULL, 10);
         if (!errno) {
           next_position =
-              min(entered_pos, positions.size ? positions.size - 1 : 0);
+              min(entered_pos, index.count ? index.count - 1 : 0);
         }
         search_idx = 0;
         search[search_idx] = '\0';
@@ -170,16 +153,17 @@ int main(int argc, char **argv) {
 
     if (IsKeyPressedRepeat(KEY_LEFT) && next_position > 0)
       next_position--;
-    if (IsKeyPressedRepeat(KEY_RIGHT) && next_position + 1 < positions.size)
+    if (IsKeyPressedRepeat(KEY_RIGHT) && next_position + 1 < index.count)
       next_position++;
 
     Image img;
 
-    if ((tex.id == 0 || current_position != next_position) && positions.data) {
+    if ((tex.id == 0 || current_position != next_position) && index.count) {
       current_position = next_position;
-      size_t pos = ((size_t *)positions.data)[current_position];
-      const RawFileHeader *const header = (const RawFileHeader *)pos;
-      const uint8_t *data = (const uint8_t *)(pos + sizeof *header);
+      const RawIndexEntry *const entry = &index.entries[current_position];
+      const RawFileHeader *const header =
+          (const RawFileHeader *)(ptr + entry->offset);
+      const uint8_t *data = (const uint8_t *)(header + 1);
       if (!splat_pixels(data, header->frame_width, header->frame_height,
                         header->color_depth, &image)) {
         fprintf(stderr, "Failed to splat pixels\n");
@@ -225,7 +209,7 @@ int main(int argc, char **argv) {
 
     BeginDrawing();
     ClearBackground(RAYWHITE);
-    if (positions.data) {
+    if (index.count) {
       float tex_scale = use_fixed_scale ? fixed_scale : natural_scale;
       SetTextureFilter(tex, use_fixed_scale ? TEXTURE_FILTER_POINT
                                             : TEXTURE_FILTER_TRILINEAR);
@@ -266,8 +250,8 @@ int main(int argc, char **argv) {
   UnloadTexture(tex);
   UnloadShader(invertShader);
   CloseWindow();
+  RawIndex_close(&index);
   unmapFile(file);
-  free(positions.data);
   free(image.data);
   return exit_code;
 }
@@ -0,0 +1,18 @@
+# Packs the frames of REEL into a .raw reel with PNG_TO_RAW, pipes it into
+# `UNBOX - OUT` and compares the files with the folder run in EXPECTED:
+#
+#   cmake -DPNG_TO_RAW=<png_to_raw> -DUNBOX=<unbox> -DREEL=<frame folder>
+#         -DOUT=<folder> -DEXPECTED=<folder> -P dev/stream_test.cmake
+
+include("${CMAKE_CURRENT_LIST_DIR}/compare_folders.cmake")
+
+file(REMOVE_RECURSE "${OUT}")
+execute_process(
+    COMMAND "${PNG_TO_RAW}" "${REEL}" -
+    COMMAND "${UNBOX}" --log-level=warning - "${OUT}"
+    RESULTS_VARIABLE results
+)
+if(NOT results STREQUAL "0;0")
+    message(FATAL_ERROR "png_to_raw | unbox failed: ${results}")
+endif()
+compare_folders("${EXPECTED}" "${OUT}")
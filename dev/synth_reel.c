@@ -0,0 +1,692 @@
+// Builds large synthetic reels out of a small sample reel, for scaling tests:
+//
+//   synth_reel [options] <sample reel folder> <output> <unbox output folder>
+//
+// The control frame and every frame before the first data frame are kept as
+// they are, the data frames are repeated up to the requested frame count. The
+// output is either a folder of numbered PNG files linked to the sample frames
+// (takes no space), or a single .raw reel of header + packed pixels + footer
+// records with valid CRC64s. Like png_to_raw, each frame of a .raw reel is
+// stored at the smallest bit depth that holds it exactly unless --depth forces
+// one, so the control frame and TOC frames are not quantized.
+//
+// A TOC describing files laid out back to back over the repeated data frames
+// is written to the unbox output folder as the cached TOC of the reel, which
+// unbox picks up instead of decoding the TOC frames. The synthetic files have
+// no checksums.
+
+#include "../src/crc64.c"
+#include "../src/raw_file.c"
+#include "../src/reel.c"
+#include <boxing/math/crc64.h>
+#include <controldata.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum SizeDistribution { SizeFixed, SizeUniform, SizeLog };
+
+typedef struct {
+  const char *sample_folder;
+  const char *output;
+  const char *unbox_output_folder;
+  unsigned frames; // total frames of the synthetic reel
+  unsigned max_files;
+  enum SizeDistribution distribution;
+  uint64_t min_size;
+  uint64_t max_size;
+  uint64_t seed;
+  uint64_t frame_capacity; // 0: derive from the sample TOC
+  bool raw;
+  uint8_t color_depth; // 0 for auto
+  bool symlink;
+} Options;
+
+static const char *const usage =
+    "Usage: %s [options] <sample reel folder> <output> <unbox output folder>\n"
+    "  --frames=N       Frames in the synthetic reel, at most 65535 (default "
+    "65535)\n"
+    "  --files=N        Stop after N files (default: fill all frames)\n"
+    "  --sizes=fixed:S | uniform:MIN:MAX | log:MIN:MAX\n"
+    "                   File size distribution, sizes take K/M/G suffixes\n"
+    "                   (default log:1K:1G)\n"
+    "  --seed=N         Seed of the file size generator (default 1)\n"
+    "  --frame-capacity=N  Data bytes per frame, if the sample TOC has no "
+    "file\n"
+    "                   spanning several frames to derive it from\n"
+    "  --format=png|raw Output a folder of PNG links (default) or a .raw "
+    "file\n"
+    "  --link=hard|sym  PNG links (default hard)\n"
+    "  --depth=auto|1|2|8  Bits per pixel in a .raw reel, auto picks the "
+    "smallest\n"
+    "                   that holds each frame exactly (default auto)\n";
+
+static const char *optionValue(const char *const restrict arg,
+                               const char *const restrict name) {
+  const size_t len = strlen(name);
+  if (strncmp(arg, name, len) == 0 && arg[len] == '=')
+    return arg + len + 1;
+  return NULL;
+}
+
+static bool parseSize(const char *restrict str, char **end, uint64_t *out) {
+  char *e;
+  uint64_t n = strtoull(str, &e, 10);
+  if (e == str)
+    return false;
+  const char *const suffixes = "KMG";
+  const char *suffix = *e ? strchr(suffixes, *e) : NULL;
+  if (suffix) {
+    n <<= 10 * (suffix - suffixes + 1);
+    e++;
+  }
+  if (end)
+    *end = e;
+  else if (*e)
+    return false;
+  *out = n;
+  return true;
+}
+
+static bool parseSizes(const char *restrict str, Options *out) {
+  char *end;
+  if (strncmp(str, "fixed:", 6) == 0) {
+    out->distribution = SizeFixed;
+    if (!parseSize(str + 6, NULL, &out->min_size))
+      return false;
+    out->max_size = out->min_size;
+  } else {
+    if (strncmp(str, "uniform:", 8) == 0) {
+      out->distribution = SizeUniform;
+      str += 8;
+    } else if (strncmp(str, "log:", 4) == 0) {
+      out->distribution = SizeLog;
+      str += 4;
+    } else
+      return false;
+    if (!parseSize(str, &end, &out->min_size) || *end != ':' ||
+        !parseSize(end + 1, NULL, &out->max_size))
+      return false;
+  }
+  return out->min_size > 0 && out->min_size <= out->max_size;
+}
+
+static bool parseOptions(int argc, char *argv[], Options *out) {
+  *out = (Options){
+      .frames = 65535,
+      .distribution = SizeLog,
+      .min_size = 1 << 10,
+      .max_size = 1 << 30,
+      .seed = 1,
+      .color_depth = 0,
+  };
+  unsigned positional = 0;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value;
+    uint64_t n;
+    if ((value = optionValue(arg, "--frames"))) {
+      if (!parseSize(value, NULL, &n) || n < 2 || n > 65535)
+        return false;
+      out->frames = (unsigned)n;
+    } else if ((value = optionValue(arg, "--files"))) {
+      if (!parseSize(value, NULL, &n) || n == 0 || n > UINT32_MAX)
+        return false;
+      out->max_files = (unsigned)n;
+    } else if ((value = optionValue(arg, "--sizes"))) {
+      if (!parseSizes(value, out))
+        return false;
+    } else if ((value = optionValue(arg, "--seed"))) {
+      if (!parseSize(value, NULL, &out->seed))
+        return false;
+    } else if ((value = optionValue(arg, "--frame-capacity"))) {
+      if (!parseSize(value, NULL, &out->frame_capacity) ||
+          !out->frame_capacity)
+        return false;
+    } else if ((value = optionValue(arg, "--format"))) {
+      if (strcmp(value, "raw") == 0)
+        out->raw = true;
+      else if (strcmp(value, "png") != 0)
+        return false;
+    } else if ((value = optionValue(arg, "--link"))) {
+      if (strcmp(value, "sym") == 0)
+        out->symlink = true;
+      else if (strcmp(value, "hard") != 0)
+        return false;
+    } else if ((value = optionValue(arg, "--depth"))) {
+      if (strcmp(value, "auto") == 0)
+        out->color_depth = 0;
+      else if (strcmp(value, "1") && strcmp(value, "2") && strcmp(value, "8"))
+        return false;
+      else
+        out->color_depth = (uint8_t)atoi(value);
+    } else if (strncmp(arg, "--", 2) == 0) {
+      return false;
+    } else if (positional == 0) {
+      out->sample_folder = arg;
+      positional++;
+    } else if (positional == 1) {
+      out->output = arg;
+      positional++;
+    } else if (positional == 2) {
+      out->unbox_output_folder = arg;
+      positional++;
+    } else {
+      return false;
+    }
+  }
+  if (out->seed == 0)
+    out->seed = 1;
+  return positional == 3;
+}
+
+static uint64_t nextRandom(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+static uint64_t nextFileSize(const Options *options, uint64_t *state) {
+  const double u = (double)(nextRandom(state) >> 11) / 9007199254740992.0;
+  switch (options->distribution) {
+  case SizeFixed:
+    return options->min_size;
+  case SizeUniform:
+    return options->min_size +
+           (uint64_t)(u * (double)(options->max_size - options->min_size));
+  case SizeLog:
+  default: {
+    // Log-uniform: as many small files as large ones per order of magnitude
+    const double lo = log((double)options->min_size);
+    const double hi = log((double)options->max_size);
+    return (uint64_t)exp(lo + u * (hi - lo));
+  }
+  }
+}
+
+// Sample frames holding file data, frames [first, last) are full
+typedef struct {
+  int first;
+  int last;
+  uint64_t capacity;
+  int template_file; // index of a regular file in the sample TOC
+} SampleLayout;
+
+static bool readSampleLayout(afs_toc_data *toc, uint64_t frame_capacity,
+                             SampleLayout *out) {
+  afs_toc_data_reel *data_reel = afs_toc_data_reels_get_reel(toc->reels, 0);
+  unsigned files = afs_toc_data_reel_file_count(data_reel);
+  *out = (SampleLayout){
+      .first = INT32_MAX,
+      .last = -1,
+      .capacity = frame_capacity,
+      .template_file = -1,
+  };
+  for (unsigned i = 0; i < files; i++) {
+    afs_toc_file *file = afs_toc_data_reel_get_file_by_index(data_reel, i);
+    if (!(file->types & AFS_TOC_FILE_TYPE_DIGITAL) ||
+        strncmp(file->file_format, "afs/directory", 13) == 0)
+      continue;
+    if (out->template_file < 0)
+      out->template_file = (int)i;
+    out->first = min(out->first, file->start_frame);
+    out->last = max(out->last, file->end_frame);
+    // size = (end_frame - start_frame) * capacity - start_byte + end_byte + 1
+    if (!frame_capacity && file->end_frame > file->start_frame)
+      out->capacity = (uint64_t)(file->size + file->start_byte -
+                                 file->end_byte - 1) /
+                      (uint64_t)(file->end_frame - file->start_frame);
+  }
+  if (out->template_file < 0) {
+    fprintf(stderr, "The sample TOC has no regular files\n");
+    return false;
+  }
+  if (!out->capacity) {
+    fprintf(stderr, "No file in the sample TOC spans several frames, pass "
+                    "--frame-capacity\n");
+    return false;
+  }
+  // The last data frame may be partially filled, only repeat full ones
+  if (out->last == out->first)
+    out->last++;
+  return true;
+}
+
+typedef struct {
+  const char *start;
+  const char *end;
+} Range;
+
+// Finds the next <tag ...>contents</tag> in [s, end), `inner` is the contents
+static bool findElement(const char *s, const char *end,
+                        const char *const restrict tag, Range *outer,
+                        Range *inner) {
+  const size_t len = strlen(tag);
+  for (; s + len + 2 < end; s++) {
+    if (s[0] != '<' || strncmp(s + 1, tag, len) != 0 ||
+        (s[len + 1] != '>' && s[len + 1] != ' '))
+      continue;
+    const char *open_end = memchr(s, '>', (size_t)(end - s));
+    if (!open_end)
+      return false;
+    for (const char *c = open_end + 1; c + len + 3 <= end; c++) {
+      if (c[0] == '<' && c[1] == '/' && strncmp(c + 2, tag, len) == 0 &&
+          c[len + 2] == '>') {
+        *inner = (Range){open_end + 1, c};
+        *outer = (Range){s, c + len + 3};
+        return true;
+      }
+    }
+    return false;
+  }
+  return false;
+}
+
+typedef struct {
+  Range range;
+  char text[32];
+} Replacement;
+
+static int compareReplacement(const void *a, const void *b) {
+  const char *x = ((const Replacement *)a)->range.start;
+  const char *y = ((const Replacement *)b)->range.start;
+  return x < y ? -1 : x > y;
+}
+
+// Element contents of the template <file> that are rewritten for every file
+enum TemplateField {
+  FieldId,
+  FieldUniqueId,
+  FieldName,
+  FieldChecksum,
+  FieldSize,
+  FieldStartFrame,
+  FieldStartByte,
+  FieldEndFrame,
+  FieldEndByte,
+  FieldCount,
+};
+
+typedef struct {
+  Range file; // the whole <file> element
+  Range fields[FieldCount];
+} FileTemplate;
+
+static bool findField(Range parent, const char *const restrict tag,
+                      bool required, Range *out) {
+  Range outer;
+  if (findElement(parent.start, parent.end, tag, &outer, out))
+    return true;
+  *out = (Range){NULL, NULL};
+  if (required)
+    fprintf(stderr, "Sample TOC: <%s> not found in <file>\n", tag);
+  return !required;
+}
+
+static bool readFileTemplate(const char *const restrict toc, size_t toc_size,
+                             int index, Range *files, FileTemplate *out) {
+  const char *const end = toc + toc_size;
+  Range inner;
+  if (!findElement(toc, end, "files", files, &inner)) {
+    fprintf(stderr, "Sample TOC: <files> not found\n");
+    return false;
+  }
+  const char *s = inner.start;
+  for (int i = 0; i <= index; i++) {
+    if (!findElement(s, inner.end, "file", &out->file, &inner)) {
+      fprintf(stderr, "Sample TOC: <file> %d not found\n", index);
+      return false;
+    }
+    s = out->file.end;
+  }
+  Range file = out->file;
+  Range start, end_element;
+  return findField(file, "id", false, &out->fields[FieldId]) &&
+         findField(file, "uniqueId", false, &out->fields[FieldUniqueId]) &&
+         findField(file, "name", true, &out->fields[FieldName]) &&
+         findField(file, "checksum", false, &out->fields[FieldChecksum]) &&
+         findField(file, "size", true, &out->fields[FieldSize]) &&
+         findField(file, "start", true, &start) &&
+         findField(start, "frame", true, &out->fields[FieldStartFrame]) &&
+         findField(start, "byte", true, &out->fields[FieldStartByte]) &&
+         findField(file, "end", true, &end_element) &&
+         findField(end_element, "frame", true, &out->fields[FieldEndFrame]) &&
+         findField(end_element, "byte", true, &out->fields[FieldEndByte]);
+}
+
+static void writeFile(FILE *f, const FileTemplate *t, unsigned id,
+                      uint64_t size, uint64_t start, uint64_t end,
+                      uint64_t capacity, int first_frame) {
+  Replacement r[FieldCount];
+  unsigned count = 0;
+  for (int i = 0; i < FieldCount; i++) {
+    if (!t->fields[i].start)
+      continue;
+    r[count].range = t->fields[i];
+    char *text = r[count].text;
+    const size_t cap = sizeof r[count].text;
+    switch ((enum TemplateField)i) {
+    case FieldId:
+    case FieldUniqueId:
+      snprintf(text, cap, "%u", id);
+      break;
+    case FieldName:
+      snprintf(text, cap, "synthetic/%06u.bin", id);
+      break;
+    case FieldChecksum:
+      text[0] = '\0';
+      break;
+    case FieldSize:
+      snprintf(text, cap, "%" PRIu64, size);
+      break;
+    case FieldStartFrame:
+      snprintf(text, cap, "%" PRIu64, first_frame + start / capacity);
+      break;
+    case FieldStartByte:
+      snprintf(text, cap, "%" PRIu64, start % capacity);
+      break;
+    case FieldEndFrame:
+      snprintf(text, cap, "%" PRIu64, first_frame + end / capacity);
+      break;
+    case FieldEndByte:
+      snprintf(text, cap, "%" PRIu64, end % capacity);
+      break;
+    case FieldCount:
+      break;
+    }
+    count++;
+  }
+  qsort(r, count, sizeof *r, compareReplacement);
+  const char *s = t->file.start;
+  for (unsigned i = 0; i < count; i++) {
+    fwrite(s, 1, (size_t)(r[i].range.start - s), f);
+    fputs(r[i].text, f);
+    s = r[i].range.end;
+  }
+  fwrite(s, 1, (size_t)(t->file.end - s), f);
+}
+
+// Lays out files back to back over data frames [first_frame, frames) and
+// writes the TOC, returns the number of files
+static unsigned writeToc(const char *const restrict path, Slice sample_toc,
+                         const Range *files, const FileTemplate *t,
+                         const SampleLayout *layout, const Options *options) {
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  const char *toc = (const char *)sample_toc.data;
+  // Everything up to and including <files ...>
+  const char *files_open =
+      (const char *)memchr(files->start, '>',
+                           (size_t)(files->end - files->start)) +
+      1;
+  fwrite(toc, 1, (size_t)(files_open - toc), f);
+  fputc('\n', f);
+
+  const uint64_t total =
+      (uint64_t)(options->frames - layout->first) * layout->capacity;
+  uint64_t state = options->seed;
+  uint64_t position = 0;
+  unsigned count = 0;
+  while (position < total &&
+         (!options->max_files || count < options->max_files)) {
+    const uint64_t size =
+        min(max(nextFileSize(options, &state), 1), total - position);
+    writeFile(f, t, count, size, position, position + size - 1,
+              layout->capacity, layout->first);
+    fputc('\n', f);
+    position += size;
+    count++;
+  }
+
+  const char *files_close = files->end - strlen("</files>");
+  fwrite(files_close, 1, sample_toc.size - (size_t)(files_close - toc), f);
+  fputc('\n', f);
+  if (fclose(f) != 0)
+    return 0;
+  printf("%u files, %" PRIu64 " bytes in %u data frames of %" PRIu64
+         " bytes\n",
+         count, position, options->frames - layout->first, layout->capacity);
+  return count;
+}
+
+// Sample frame that output frame `f` is a copy of
+static int sampleFrame(const SampleLayout *layout, unsigned f) {
+  if (f < (unsigned)layout->first)
+    return (int)f;
+  return layout->first +
+         (int)((f - (unsigned)layout->first) %
+               (unsigned)(layout->last - layout->first));
+}
+
+static bool linkFrames(const Reel *reel, const SampleLayout *layout,
+                       const Options *options) {
+  mkdir(options->output, 0755);
+  char source[4096];
+  char target[4096];
+  for (unsigned f = 1; f < options->frames; f++) {
+    const int s = sampleFrame(layout, f);
+    if (!reel->frames[s])
+      continue;
+    const char *name =
+        (const char *)reel->string_pool.data + reel->frames[s] - 1;
+    const char *ext = strrchr(name, '.');
+    snprintf(target, sizeof target, "%s/%06u%s", options->output, f,
+             ext ? ext : "");
+    if (options->symlink) {
+      // Relative links would need the path from output to sample folder
+      char *resolved = realpath(reel->directory_path, NULL);
+      if (!resolved)
+        return false;
+      snprintf(source, sizeof source, "%s/%s", resolved, name);
+      free(resolved);
+    } else {
+      snprintf(source, sizeof source, "%s/%s", reel->directory_path, name);
+    }
+    unlink(target);
+    if ((options->symlink ? symlink(source, target) : link(source, target))) {
+      fprintf(stderr, "%s: %s\n", target, strerror(errno));
+      return false;
+    }
+  }
+  return true;
+}
+
+// Header, packed pixels and footer of a sample frame, written once for every
+// frame repeating it with its own frame id and CRC
+typedef Slice RawFrame;
+
+static bool writeRawFrame(FILE *f, const Crc64 *crc64, dcrc64 *fallback,
+                          RawFrame *frame, uint64_t frame_id) {
+  uint8_t *const p = (uint8_t *)frame->data;
+  ((RawFileHeader *)p)->frame_id = frame_id;
+  RawFileFooter *const footer = (RawFileFooter *)(p + frame->size) - 1;
+  raw_set_footer_crc(footer, crc64_calc(crc64, fallback, p,
+                                        frame->size - sizeof footer->crc));
+  return fwrite(p, 1, frame->size, f) == frame->size;
+}
+
+static bool loadRawFrame(Reel *reel, int s, uint8_t color_depth,
+                         RawFrame *out) {
+  Image image = Reel_load_frame_into(reel, reel->arena, s);
+  if (!image.data)
+    return false;
+  const uint32_t width = (uint32_t)image.width;
+  const uint32_t height = (uint32_t)image.height;
+  const size_t pixels = (size_t)width * height;
+  uint8_t depth =
+      color_depth ? color_depth : detectColorDepth(image.data, pixels);
+  // Packed pixels of a frame have to fill whole bytes
+  if (pixels % (8 / depth) != 0) {
+    if (color_depth) {
+      fprintf(stderr,
+              "Frame %d of %" PRIu32 "x%" PRIu32
+              " can not be packed to %" PRIu8 " bits\n",
+              s, width, height, depth);
+      return false;
+    }
+    depth = 8;
+  }
+  RawFileHeader header;
+  memset(&header, 0, sizeof header);
+  header.frame_height = height;
+  header.frame_width = width;
+  header.color_depth = depth;
+  header.version = 1;
+  // Gray levels, 0 standing in for 256
+  header.colors_per_channel = (uint8_t)(1u << depth);
+  const size_t size = raw_frame_record_size(&header);
+  *out = (RawFrame){.data = calloc(1, size), .size = size};
+  if (!out->data)
+    return false;
+  uint8_t *const p = (uint8_t *)out->data;
+  memcpy(p, &header, sizeof header);
+  return pack_pixels(image.data, width, height, depth, p + sizeof header);
+}
+
+static bool writeRawReel(Reel *reel, const SampleLayout *layout,
+                         const Options *options) {
+  const int distinct = layout->last;
+  RawFrame *frames = calloc((size_t)distinct, sizeof *frames);
+  Crc64 crc64;
+  dcrc64 *fallback =
+      crc64_init(&crc64) ? NULL : boxing_math_crc64_create_def();
+  FILE *f = fopen(options->output, "wb");
+  bool ok = frames && (crc64.ok || fallback) && f;
+  if (!f)
+    fprintf(stderr, "%s: %s\n", options->output, strerror(errno));
+  // Each distinct sample frame is decoded and packed once
+  for (int s = 1; ok && s < distinct; s++)
+    if (reel->frames[s] && !loadRawFrame(reel, s, options->color_depth,
+                                          &frames[s])) {
+      fprintf(stderr, "Failed to load sample frame %d\n", s);
+      ok = false;
+    }
+  for (unsigned fr = 1; ok && fr < options->frames; fr++) {
+    const int s = sampleFrame(layout, fr);
+    if (frames[s].data)
+      ok = writeRawFrame(f, &crc64, fallback, &frames[s], fr);
+  }
+  if (f && fclose(f) != 0)
+    ok = false;
+  if (frames)
+    for (int s = 0; s < distinct; s++)
+      free(frames[s].data);
+  free(frames);
+  if (fallback)
+    boxing_math_crc64_free(fallback);
+  return ok;
+}
+
+// Writes the synthetic TOC and frames for a decoded sample reel
+static bool generate(Reel *reel, Slice control_frame, Slice toc_contents,
+                     const Options *options) {
+  afs_toc_data *toc = afs_toc_data_create();
+  if (!toc)
+    return false;
+  if (!afs_toc_data_load_string(toc, (const char *)toc_contents.data)) {
+    fprintf(stderr, "Failed to parse the sample TOC\n");
+    afs_toc_data_free(toc);
+    return false;
+  }
+  SampleLayout layout;
+  bool ok = readSampleLayout(toc, options->frame_capacity, &layout);
+  afs_toc_data_free(toc);
+  Range files;
+  FileTemplate file_template;
+  if (!ok || !readFileTemplate(toc_contents.data, toc_contents.size,
+                               layout.template_file, &files, &file_template))
+    return false;
+  if (options->frames <= (unsigned)layout.first) {
+    fprintf(stderr, "--frames must be larger than the first data frame (%d)\n",
+            layout.first);
+    return false;
+  }
+
+  // unbox looks for a cached TOC under the CRC64 of the control frame
+  dcrc64 *crc = boxing_math_crc64_create_def();
+  if (!crc)
+    return false;
+  const uint64_t control_frame_crc = boxing_math_crc64_calc_crc(
+      crc, control_frame.data, (unsigned)control_frame.size);
+  boxing_math_crc64_free(crc);
+  char toc_path[4096];
+  mkdir(options->unbox_output_folder, 0755);
+  snprintf(toc_path, sizeof toc_path, "%s/toc_%" PRIx64 ".xml",
+           options->unbox_output_folder, control_frame_crc);
+  if (!writeToc(toc_path, toc_contents, &files, &file_template, &layout,
+                options))
+    return false;
+  printf("TOC: %s\n", toc_path);
+
+  if (!(options->raw ? writeRawReel(reel, &layout, options)
+                     : linkFrames(reel, &layout, options)))
+    return false;
+  printf("%u frames: %s\n", options->frames - 1, options->output);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    fprintf(stderr, usage, argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  ImageArena arena = {.memory = NULL, .used = 0};
+  Reel *reel = Reel_create(&arena);
+  if (!reel)
+    return EXIT_FAILURE;
+  if (!Reel_init(reel, options.sample_folder) ||
+      reel->source != ReelDirectory) {
+    fprintf(stderr, "%s: no frames found\n", options.sample_folder);
+    Reel_destroy(reel);
+    image_deinit(&arena);
+    return EXIT_FAILURE;
+  }
+  int status = EXIT_FAILURE;
+  bool is_raw;
+  Slice control_frame = Reel_unbox_control_frame(reel, &is_raw);
+  afs_control_data *ctl = afs_control_data_create();
+  if (control_frame.data && ctl &&
+      afs_control_data_load_string(ctl, (const char *)control_frame.data) &&
+      afs_toc_files_get_tocs_count(ctl->technical_metadata->afs_tocs) > 0) {
+    Unboxer unboxer;
+    Slice payload = Slice_empty;
+    if (UnboxerCreate(
+            ctl->technical_metadata->afs_content_boxing_format->config, is_raw,
+            &unboxer) == UnboxerInitOK) {
+      Slice toc_contents = Reel_unbox_toc(
+          reel, &unboxer, &payload,
+          afs_toc_files_get_toc(ctl->technical_metadata->afs_tocs, 0));
+      if (toc_contents.data) {
+        if (generate(reel, control_frame, toc_contents, &options))
+          status = EXIT_SUCCESS;
+        free(toc_contents.data);
+      } else {
+        fprintf(stderr, "Failed to unbox the sample TOC\n");
+      }
+      UnboxerDestroy(&unboxer);
+      free(payload.data);
+    }
+  } else {
+    fprintf(stderr, "Failed to unbox the sample control frame\n");
+  }
+  if (ctl)
+    afs_control_data_free(ctl);
+  free(control_frame.data);
+  Reel_destroy(reel);
+  image_deinit(&arena);
+  return status;
+}
@@ -0,0 +1,26 @@
+# Packs the frames of REEL into a tar archive, unboxes it with UNBOX into OUT
+# and compares the files with the folder run in EXPECTED:
+#
+#   cmake -DUNBOX=<unbox> -DREEL=<frame folder> -DOUT=<folder>
+#         -DEXPECTED=<folder> -P dev/tar_test.cmake
+
+include("${CMAKE_CURRENT_LIST_DIR}/compare_folders.cmake")
+
+file(REMOVE_RECURSE "${OUT}")
+file(MAKE_DIRECTORY "${OUT}")
+# Members keep the folder in their path, unbox only reads the file names
+execute_process(
+    COMMAND "${CMAKE_COMMAND}" -E tar cf "${OUT}/reel.tar" "${REEL}"
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${OUT}/reel.tar: tar failed: ${result}")
+endif()
+execute_process(
+    COMMAND "${UNBOX}" --log-level=warning "${OUT}/reel.tar" "${OUT}/files"
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "unbox failed: ${result}")
+endif()
+compare_folders("${EXPECTED}" "${OUT}/files")
@@ -0,0 +1,59 @@
+#ifndef COPY_RANGE_C
+#define COPY_RANGE_C
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Copies `size` bytes at `offset` in `in_fd` to the start of the empty file
+// `out_fd` without passing them through user space. Block aligned extents are
+// shared with the source (reflink, XFS and btrfs), the rest is copied in the
+// kernel with copy_file_range. Returns how many leading bytes were copied,
+// which is 0 where neither is supported; the caller writes the rest.
+static size_t copy_range(const int out_fd, const int in_fd,
+                         const uint64_t offset, const size_t size) {
+  size_t done = 0;
+#ifdef __linux__
+  struct stat s;
+  if (fstat(in_fd, &s) == 0 && s.st_blksize > 0 &&
+      offset % (uint64_t)s.st_blksize == 0) {
+    const size_t aligned = size / (size_t)s.st_blksize * (size_t)s.st_blksize;
+    struct file_clone_range range = {
+        .src_fd = in_fd,
+        .src_offset = offset,
+        .src_length = aligned,
+        .dest_offset = 0,
+    };
+    if (aligned && ioctl(out_fd, FICLONERANGE, &range) == 0)
+      done = aligned;
+  }
+#ifdef SYS_copy_file_range
+  while (done < size) {
+    int64_t in_offset = (int64_t)(offset + done);
+    int64_t out_offset = (int64_t)done;
+    const long n = syscall(SYS_copy_file_range, in_fd, &in_offset, out_fd,
+                           &out_offset, size - done, 0u);
+    if (n > 0)
+      done += (size_t)n;
+    else if (n == 0 || errno != EINTR)
+      break;
+  }
+#endif
+#else
+  (void)out_fd;
+  (void)in_fd;
+  (void)offset;
+  (void)size;
+#endif
+  return done;
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef CRC64_C
+#define CRC64_C
+
+#include "../dep/afs/unboxing/inc/boxing/math/crc64.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Slicing-by-8 CRC64, bit-for-bit compatible with boxing_math_crc64_calc_crc
+// but processing 8 bytes per step instead of 1. The tables are derived from
+// the CRCs the library computes for single bytes, so they follow whatever
+// polynomial and bit order it uses, and the result is checked against the
+// library before it is trusted. The tables are read-only after crc64_init and
+// can be shared between threads, unlike a dcrc64 instance.
+
+typedef struct {
+  uint64_t table[8][256];
+  bool reflected; // LSB-first
+  bool ok;        // matches the library
+} Crc64;
+
+static inline uint64_t crc64_update(const Crc64 *c, uint64_t crc,
+                                    const void *const restrict data,
+                                    size_t size) {
+  const uint8_t *p = (const uint8_t *)data;
+  const uint64_t(*t)[256] = c->table;
+  if (c->reflected) {
+    for (; size >= 8; size -= 8, p += 8) {
+      uint64_t x = crc;
+      for (unsigned i = 0; i < 8; i++)
+        x ^= (uint64_t)p[i] << (i * 8);
+      crc = t[7][x & 0xff] ^ t[6][(x >> 8) & 0xff] ^ t[5][(x >> 16) & 0xff] ^
+            t[4][(x >> 24) & 0xff] ^ t[3][(x >> 32) & 0xff] ^
+            t[2][(x >> 40) & 0xff] ^ t[1][(x >> 48) & 0xff] ^ t[0][x >> 56];
+    }
+    for (; size; size--, p++)
+      crc = t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+  } else {
+    for (; size >= 8; size -= 8, p += 8) {
+      uint64_t x = crc;
+      for (unsigned i = 0; i < 8; i++)
+        x ^= (uint64_t)p[i] << (56 - i * 8);
+      crc = t[7][x >> 56] ^ t[6][(x >> 48) & 0xff] ^ t[5][(x >> 40) & 0xff] ^
+            t[4][(x >> 32) & 0xff] ^ t[3][(x >> 24) & 0xff] ^
+            t[2][(x >> 16) & 0xff] ^ t[1][(x >> 8) & 0xff] ^ t[0][x & 0xff];
+    }
+    for (; size; size--, p++)
+      crc = t[0][((crc >> 56) ^ *p) & 0xff] ^ (crc << 8);
+  }
+  return crc;
+}
+
+static inline void crc64_build(Crc64 *c, bool reflected) {
+  c->reflected = reflected;
+  for (unsigned k = 1; k < 8; k++) {
+    for (unsigned b = 0; b < 256; b++) {
+      const uint64_t prev = c->table[k - 1][b];
+      c->table[k][b] = reflected ? (prev >> 8) ^ c->table[0][prev & 0xff]
+                                 : (prev << 8) ^ c->table[0][prev >> 56];
+    }
+  }
+}
+
+// Derives the tables from the library's default CRC64. Returns false if
+// neither bit order reproduces the library, callers then have to use
+// boxing_math_crc64_calc_crc.
+static inline bool crc64_init(Crc64 *c) {
+  memset(c, 0, sizeof *c);
+  dcrc64 *lib = boxing_math_crc64_create_def();
+  if (!lib)
+    return false;
+  for (unsigned b = 0; b < 256; b++) {
+    const char byte = (char)b;
+    boxing_math_crc64_reset(lib, 0);
+    c->table[0][b] = boxing_math_crc64_calc_crc(lib, &byte, 1);
+  }
+
+  // An odd length exercises both the 8 byte steps and the tail
+  uint8_t sample[1031];
+  uint64_t x = 0x9e3779b97f4a7c15ull;
+  for (size_t i = 0; i < sizeof sample; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sample[i] = (uint8_t)x;
+  }
+  const uint64_t seed = 0x0123456789abcdefull;
+  boxing_math_crc64_reset(lib, seed);
+  const uint64_t expected =
+      boxing_math_crc64_calc_crc(lib, (const char *)sample, sizeof sample);
+  boxing_math_crc64_free(lib);
+
+  for (int reflected = 0; reflected < 2 && !c->ok; reflected++) {
+    crc64_build(c, reflected);
+    c->ok = crc64_update(c, seed, sample, sizeof sample) == expected;
+  }
+  return c->ok;
+}
+
+// CRC64 with seed 0 through the tables, or through `fallback` (one per thread)
+// if they did not match the library
+static inline uint64_t crc64_calc(const Crc64 *c, dcrc64 *fallback,
+                                  const void *const restrict data,
+                                  const size_t size) {
+  if (c->ok)
+    return crc64_update(c, 0, data, size);
+  boxing_math_crc64_reset(fallback, 0);
+  return boxing_math_crc64_calc_crc(fallback, (const char *)data,
+                                    (unsigned)size);
+}
+
+#endif
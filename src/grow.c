@@ -1,3 +1,6 @@
+#ifndef GROW_C
+#define GROW_C
+
 #include "types.h"
 #include <stdbool.h>
 #include <stdlib.h>
@@ -22,3 +25,5 @@ static bool grow(void **ptr, size_t size, size_t *cap, size_t required_cap) {
     new_cap *= 2;
   return grow_exact(ptr, size, cap, new_cap);
 }
+
+#endif
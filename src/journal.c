@@ -0,0 +1,130 @@
+#ifndef JOURNAL_C
+#define JOURNAL_C
+
+#include "grow.c"
+#include "map_file.c"
+#include "types.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+// The journal is an append-only text file in the output folder with one line
+// per completed file: "<toc index> <size> <checksum>\n". A line only counts
+// once its newline is on disk, so a record torn by a crash is ignored.
+
+typedef struct {
+  bool present;
+  int64_t size;
+  char checksum[48];
+} JournalEntry;
+
+typedef struct {
+  FILE *file;
+  JournalEntry *entries; // indexed by TOC file index
+  size_t entries_cap;
+} Journal;
+
+static bool Journal_set(Journal *journal, uint32_t index, int64_t size,
+                        const char *restrict checksum) {
+  size_t old_cap = journal->entries_cap;
+  if (!grow((void **)&journal->entries, sizeof *journal->entries,
+            &journal->entries_cap, (size_t)index + 1))
+    return false;
+  if (journal->entries_cap > old_cap)
+    memset(journal->entries + old_cap, 0,
+           (journal->entries_cap - old_cap) * sizeof *journal->entries);
+  if (checksum && strcmp(checksum, "-") == 0)
+    checksum = NULL;
+  JournalEntry *entry = &journal->entries[index];
+  entry->present = true;
+  entry->size = size;
+  snprintf(entry->checksum, sizeof entry->checksum, "%s",
+           checksum ? checksum : "");
+  return true;
+}
+
+static void Journal_load(Journal *journal, const char *const restrict path) {
+  Slice contents = mapFile(path);
+  if (!contents.data)
+    return;
+  const char *const text = (const char *)contents.data;
+  size_t line_start = 0;
+  for (size_t i = 0; i < contents.size; i++) {
+    if (text[i] != '\n')
+      continue;
+    char line[128];
+    size_t line_len = min(i - line_start, sizeof line - 1);
+    memcpy(line, text + line_start, line_len);
+    line[line_len] = '\0';
+    line_start = i + 1;
+    unsigned index;
+    int64_t size;
+    char checksum[48] = {0};
+    int fields = sscanf(line, "%u %" SCNd64 " %47s", &index, &size, checksum);
+    if (fields >= 2)
+      Journal_set(journal, index, size, checksum);
+  }
+  unmapFile(contents);
+}
+
+static bool Journal_open(Journal *journal, const char *const restrict path) {
+  *journal = (Journal){.file = NULL, .entries = NULL, .entries_cap = 0};
+  Journal_load(journal, path);
+  journal->file = fopen(path, "ab");
+  return journal->file != NULL;
+}
+
+static void Journal_close(Journal *journal) {
+  if (journal->file)
+    fclose(journal->file);
+  free(journal->entries);
+  *journal = (Journal){.file = NULL, .entries = NULL, .entries_cap = 0};
+}
+
+// Returns true if the file was recorded as complete by an earlier run and the
+// output on disk still has the expected size.
+static bool Journal_is_complete(const Journal *journal, uint32_t index,
+                                int64_t size,
+                                const char *const restrict checksum,
+                                const char *const restrict output_path) {
+  if (index >= journal->entries_cap || !journal->entries[index].present)
+    return false;
+  const JournalEntry *entry = &journal->entries[index];
+  if (entry->size != size ||
+      strcmp(entry->checksum, checksum ? checksum : "") != 0)
+    return false;
+  struct stat s;
+  return stat(output_path, &s) == 0 && (int64_t)s.st_size == size;
+}
+
+// Flush a written file all the way to disk, so a journal record never points
+// at data that only existed in the page cache.
+static bool syncFile(FILE *f) {
+  if (fflush(f) != 0)
+    return false;
+#ifdef _WIN32
+  return _commit(_fileno(f)) == 0;
+#else
+  return fsync(fileno(f)) == 0;
+#endif
+}
+
+static bool Journal_record(Journal *journal, uint32_t index, int64_t size,
+                           const char *const restrict checksum) {
+  if (!journal->file)
+    return false;
+  if (fprintf(journal->file, "%u %" PRId64 " %s\n", index, size,
+              checksum && checksum[0] ? checksum : "-") < 0)
+    return false;
+  return syncFile(journal->file) &&
+         Journal_set(journal, index, size, checksum);
+}
+
+#endif
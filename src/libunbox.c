@@ -0,0 +1,913 @@
+#include "libunbox.h"
+#include "../dep/afs/src/sha1hash.c"
+#include "copy_range.c"
+#include "journal.c"
+#include "reel.c"
+#include "sparse_write.c"
+#include "types.h"
+#include "unboxing_log.c"
+#include <boxing/config.h>
+#include <boxing/math/crc64.h>
+#include <boxing/unboxer.h>
+#include <controldata.h>
+#include <inttypes.h>
+#include <mxml.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include "win32.h"
+#include <process.h>
+#define getpid _getpid
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static bool writePathSegment(const char *const restrict input, Slice scratch,
+                             unsigned *restrict cursor) {
+  const size_t input_len = strlen(input);
+  for (size_t i = 0; i < *cursor; i++)
+    ((char *)scratch.data)[i] = input[i];
+  size_t j;
+  for (j = *cursor; j < input_len && j < scratch.size; j++) {
+    if (input[j] == '/') {
+      *cursor = (unsigned)j + 1;
+      return true;
+    }
+    ((char *)scratch.data)[j] = input[j];
+  }
+  ((char *)scratch.data)[j] = '\0';
+  return false;
+}
+
+static void ensurePathExists(const char *const restrict path) {
+  char buf[256] = {0};
+  unsigned cursor = 0;
+  for (;;) {
+    if (writePathSegment(path, sliceof(buf), &cursor)) {
+      mkdir(buf, 0755);
+    } else
+      break;
+  }
+}
+
+// One message per line, so each fits a slot of an async log
+static void logControlFrame(Slice xml) {
+  const char *line = xml.data;
+  const char *const end = line + xml.size;
+  while (line < end) {
+    const char *eol = memchr(line, '\n', (size_t)(end - line));
+    if (!eol)
+      eol = end;
+    boxing_log_args(BoxingLogLevelInfo, "%.*s", (int)(eol - line), line);
+    line = eol + 1;
+  }
+}
+
+static void printReelInformation(afs_administrative_metadata *md) {
+  boxing_log(BoxingLogLevelAlways, "");
+  boxing_log_args(BoxingLogLevelAlways, "Reel ID: %s", md->reel_id);
+  boxing_log_args(BoxingLogLevelAlways, "Print Reel ID: %s", md->print_reel_id);
+  boxing_log_args(BoxingLogLevelAlways, "Title: %s", md->title);
+  boxing_log_args(BoxingLogLevelAlways, "Description: %s", md->description);
+  boxing_log_args(BoxingLogLevelAlways, "Creator: %s", md->creator);
+  boxing_log_args(BoxingLogLevelAlways, "Creation Date: %s", md->creation_date);
+  boxing_log(BoxingLogLevelAlways, "");
+}
+
+// Written to a temporary file first and renamed into place, so concurrent
+// shards never see a partly written cache file
+static bool writeEntireFile(const char *const restrict file_path, Slice data) {
+  char tmp_path[4096];
+  snprintf(tmp_path, sizeof tmp_path, "%s.%ld.tmp", file_path,
+           (long)getpid());
+  FILE *f = fopen(tmp_path, "wb");
+  if (!f)
+    return false;
+  size_t total_written = 0;
+  while (total_written < data.size) {
+    size_t written = fwrite((const char *)data.data + total_written, 1,
+                            data.size - total_written, f);
+    if (written == 0) {
+      fclose(f);
+      remove(tmp_path);
+      return false;
+    }
+    total_written += written;
+  }
+  // Another shard may have put the same contents in place first (Windows
+  // does not replace existing files)
+  if (fclose(f) != 0 || rename(tmp_path, file_path) != 0) {
+    remove(tmp_path);
+    return false;
+  }
+  return true;
+}
+
+// Makes `path` a copy of the `size` byte file at `source_path`: a hard link
+// if asked for and possible, else extents shared with it or copied in the
+// kernel where the filesystem can (see copy_range), else a plain copy
+static bool copyFile(const char *const restrict source_path,
+                     const char *const restrict path, const size_t size,
+                     const bool hard_link) {
+  uint8_t buffer[1 << 16];
+  if (strcmp(source_path, path) == 0)
+    return true;
+  // Writing to a hard link made by an earlier run would change its source
+  remove(path);
+#ifdef _WIN32
+  if (hard_link) {
+    if (CreateHardLinkA(path, source_path, NULL))
+      return true;
+  }
+  FILE *in = fopen(source_path, "rb");
+  if (!in)
+    return false;
+  FILE *out = fopen(path, "wb");
+  if (!out) {
+    fclose(in);
+    return false;
+  }
+  size_t done = 0;
+  bool ok = true;
+  while (ok && done < size) {
+    const size_t n = fread(buffer, 1, min(sizeof buffer, size - done), in);
+    ok = n > 0 && fwrite(buffer, 1, n, out) == n;
+    done += n;
+  }
+  ok = syncFile(out) && ok;
+  fclose(out);
+  fclose(in);
+  return ok;
+#else
+  if (hard_link) {
+    if (link(source_path, path) == 0)
+      return true;
+  }
+  const int in = open(source_path, O_RDONLY);
+  if (in == -1)
+    return false;
+  const int out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out == -1) {
+    close(in);
+    return false;
+  }
+  size_t done = copy_range(out, in, 0, size);
+  bool ok = true;
+  while (ok && done < size) {
+    const ssize_t n = pread(in, buffer, min(sizeof buffer, size - done),
+                            (off_t)done);
+    ok = n > 0 && pwrite(out, buffer, (size_t)n, (off_t)done) == n;
+    if (ok)
+      done += (size_t)n;
+  }
+  ok = fsync(out) == 0 && ok;
+  close(out);
+  close(in);
+  return ok;
+#endif
+}
+
+static int checksumCompare(const char *restrict a, const char *restrict b) {
+  for (;; a++, b++) {
+    char ca = *a >= 'A' && *a <= 'Z' ? (char)(*a - 'A' + 'a') : *a;
+    char cb = *b >= 'A' && *b <= 'Z' ? (char)(*b - 'A' + 'a') : *b;
+    if (ca != cb || !ca)
+      return (unsigned char)ca - (unsigned char)cb;
+  }
+}
+
+static bool checksumEquals(const char *restrict a, const char *restrict b) {
+  return checksumCompare(a, b) == 0;
+}
+
+// Files that take up frames on the reel, the rest are only listed in the TOC
+static bool fileHasFrames(const afs_toc_file *file) {
+  return (file->types & AFS_TOC_FILE_TYPE_DIGITAL) &&
+         strncmp(file->file_format, "afs/directory", 13) != 0 &&
+         file->end_frame >= file->start_frame;
+}
+
+// Splits the files of the TOC into `count` shards of about the same number of
+// frames, in TOC order so a shard reads a contiguous run of the reel. A file
+// goes to the shard its middle frame falls in, which only depends on the TOC,
+// so every process computes the same split. Returns the shard of each file.
+static unsigned *assignShards(afs_toc_data_reel *data_reel, unsigned files,
+                              unsigned count) {
+  unsigned *shards = calloc(files ? files : 1, sizeof *shards);
+  if (!shards)
+    return NULL;
+  uint64_t total = 0;
+  for (unsigned i = 0; i < files; i++) {
+    afs_toc_file *file = afs_toc_data_reel_get_file_by_index(data_reel, i);
+    if (fileHasFrames(file))
+      total += (uint64_t)(file->end_frame - file->start_frame) + 1;
+  }
+  uint64_t before = 0;
+  for (unsigned i = 0; i < files && total; i++) {
+    afs_toc_file *file = afs_toc_data_reel_get_file_by_index(data_reel, i);
+    const uint64_t frames =
+        fileHasFrames(file)
+            ? (uint64_t)(file->end_frame - file->start_frame) + 1
+            : 0;
+    shards[i] = (unsigned)((before * 2 + frames) * count / (total * 2));
+    shards[i] = min(shards[i], count - 1);
+    before += frames;
+  }
+  return shards;
+}
+
+typedef struct {
+  unsigned index;
+  unsigned count; // 1 when not sharding
+} Shard;
+
+typedef struct {
+  const afs_toc_file *file;
+  unsigned index;
+} TocEntry;
+
+static int compareContents(const void *a, const void *b) {
+  const TocEntry *x = a;
+  const TocEntry *y = b;
+  if (x->file->size != y->file->size)
+    return x->file->size < y->file->size ? -1 : 1;
+  const int c = checksumCompare(x->file->checksum, y->file->checksum);
+  if (c)
+    return c;
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// Groups the files of the shard with the same checksum and size, returns the
+// first file of the group of every file (itself if it is the first or has no
+// checksum). Only the first file of a group has to be decoded.
+static unsigned *findDuplicates(afs_toc_data_reel *data_reel,
+                                const unsigned files,
+                                const unsigned *const shards,
+                                const unsigned shard) {
+  unsigned *originals = malloc((files ? files : 1) * sizeof *originals);
+  TocEntry *entries = malloc((files ? files : 1) * sizeof *entries);
+  if (!originals || !entries) {
+    free(originals);
+    free(entries);
+    return NULL;
+  }
+  unsigned count = 0;
+  for (unsigned i = 0; i < files; i++) {
+    afs_toc_file *file = afs_toc_data_reel_get_file_by_index(data_reel, i);
+    originals[i] = i;
+    if (shards[i] == shard && fileHasFrames(file) && file->size > 0 &&
+        file->checksum && file->checksum[0])
+      entries[count++] = (TocEntry){.file = file, .index = i};
+  }
+  if (count)
+    qsort(entries, count, sizeof *entries, compareContents);
+  for (unsigned i = 1; i < count; i++)
+    if (entries[i].file->size == entries[i - 1].file->size &&
+        checksumEquals(entries[i].file->checksum,
+                       entries[i - 1].file->checksum))
+      originals[entries[i].index] = originals[entries[i - 1].index];
+  free(entries);
+  return originals;
+}
+
+static bool unboxAndOutputFiles(Reel *reel, Unboxer *unboxer, Slice *payload,
+                                Slice toc_contents,
+                                const char *const restrict output_folder,
+                                Journal *journal, Shard shard,
+                                enum unbox_dedup dedup) {
+  afs_toc_data *toc = afs_toc_data_create();
+  if (!toc)
+    return false;
+  if (!afs_toc_data_load_string(toc, toc_contents.data)) {
+    afs_toc_data_free(toc);
+    return false;
+  }
+  afs_toc_data_reel *data_reel = afs_toc_data_reels_get_reel(toc->reels, 0);
+  unsigned files = afs_toc_data_reel_file_count(data_reel);
+  unsigned *shards = assignShards(data_reel, files, shard.count);
+  unsigned *originals =
+      shards && dedup != UNBOX_DEDUP_OFF
+          ? findDuplicates(data_reel, files, shards, shard.index)
+          : NULL;
+  // Files of this run that are complete on disk, to copy duplicates from
+  bool *on_disk = calloc(files ? files : 1, sizeof *on_disk);
+  if (!shards || (dedup != UNBOX_DEDUP_OFF && !originals) || !on_disk) {
+    free(on_disk);
+    free(originals);
+    free(shards);
+    afs_toc_data_free(toc);
+    return false;
+  }
+  // A streamed reel only keeps the frames of files that are still to be
+  // written, the checks below are repeated for that. Duplicates are copied,
+  // if that fails after their frames went by they fail too.
+  for (unsigned i = 0; reel->source == ReelStream && i < files; i++) {
+    afs_toc_file *file = afs_toc_data_reel_get_file_by_index(data_reel, i);
+    char output_file_path[4096];
+    snprintf(output_file_path, sizeof output_file_path, "%s/%s", output_folder,
+             file->name);
+    if (shards[i] == shard.index && fileHasFrames(file) &&
+        (!originals || originals[i] == i) &&
+        !Journal_is_complete(journal, i, file->size, file->checksum,
+                             output_file_path))
+      Reel_expect_frames(reel, file->start_frame, file->end_frame);
+  }
+  bool ok = true;
+  unsigned skipped = 0;
+  unsigned copied = 0;
+  for (unsigned i = 0; i < files; i++) {
+    afs_toc_file *file = afs_toc_data_reel_get_file_by_index(data_reel, i);
+    if (shards[i] != shard.index)
+      continue;
+    if (!(file->types & AFS_TOC_FILE_TYPE_DIGITAL)) {
+      boxing_log_args(BoxingLogLevelInfo, "Skipping non-digital file: %s",
+                      file->name);
+      continue;
+    }
+
+    char output_file_path[4096];
+    snprintf(output_file_path, sizeof output_file_path, "%s/%s", output_folder,
+             file->name);
+
+    if (Journal_is_complete(journal, i, file->size, file->checksum,
+                            output_file_path)) {
+      on_disk[i] = true;
+      skipped++;
+      continue;
+    }
+
+    boxing_log_args(BoxingLogLevelInfo,
+                    "%d[%d]..%d[%d] (size: %" PRId64 ") %s (%s) [%s]",
+                    file->start_frame, file->start_byte, file->end_frame,
+                    file->end_byte, file->size, file->name, file->checksum,
+                    file->file_format);
+
+    ensurePathExists(output_file_path);
+
+    if (strncmp(file->file_format, "afs/directory", 13) == 0) {
+      // directory names always end with /, ensurePathExists already created
+      // this directory, or if not, this implementation creates the entire
+      // parent path of each file anyway.
+      continue;
+    }
+
+    const unsigned original = originals ? originals[i] : i;
+    if (original != i && on_disk[original]) {
+      afs_toc_file *source =
+          afs_toc_data_reel_get_file_by_index(data_reel, original);
+      char source_path[4096];
+      snprintf(source_path, sizeof source_path, "%s/%s", output_folder,
+               source->name);
+      const uint64_t t0 = stats_clock();
+      const bool done = copyFile(source_path, output_file_path,
+                                 (size_t)file->size,
+                                 dedup == UNBOX_DEDUP_HARDLINK);
+      stats_record(StageWrite, t0);
+      if (done) {
+        boxing_log_args(BoxingLogLevelInfo, "Copied %s from identical %s",
+                        file->name, source->name);
+        on_disk[i] = true;
+        copied++;
+        if (!Journal_record(journal, i, file->size, file->checksum))
+          boxing_log_args(BoxingLogLevelWarning,
+                          "Failed to record %s in resume journal", file->name);
+        continue;
+      }
+      boxing_log_args(BoxingLogLevelWarning,
+                      "Failed to copy %s from identical %s, decoding it",
+                      file->name, source->name);
+    }
+
+    // Drops a hard link to an identical file made by an earlier run
+    remove(output_file_path);
+    FILE *output_file = fopen(output_file_path, "w+b");
+
+    if (!output_file) {
+      afs_toc_data_free(toc);
+      free(on_disk);
+      free(originals);
+      free(shards);
+      return false;
+    }
+    // Frames are written in large slices straight from the decode buffer, so
+    // skip the extra copy through a stdio buffer.
+    setvbuf(output_file, NULL, _IONBF, 0);
+
+    boxing_unboxer_reset(unboxer->unboxer);
+
+    afs_hash1_state sha1;
+    afs_sha1_init(&sha1);
+    // Runs of zeros, as in disk images, are left as holes
+    SparseFile output = {.file = output_file, .offset = 0, .holes = false};
+    bool write_ok = true;
+    size_t bytes_written = 0;
+    size_t bytes_to_skip = file->start_byte;
+    for (int f = file->start_frame; f <= file->end_frame; f++) {
+      Image data_frame = Reel_load_frame(reel, f);
+      if (!data_frame.data) {
+        fclose(output_file);
+        afs_toc_data_free(toc);
+        free(on_disk);
+        free(originals);
+        free(shards);
+        return false;
+      }
+
+      Slice frame_contents;
+      FrameInfo info;
+      enum UnboxerUnboxStatus status = UnboxerUnbox(
+          unboxer, data_frame.data, data_frame.width, data_frame.height,
+          BOXING_METADATA_CONTENT_TYPES_DATA, payload, &frame_contents, &info);
+      FrameInfo_log(&info, status == UnboxOK ? BoxingLogLevelDebug
+                                             : BoxingLogLevelError);
+      if (status != UnboxOK) {
+        fclose(output_file);
+        afs_toc_data_free(toc);
+        free(on_disk);
+        free(originals);
+        free(shards);
+        return false;
+      }
+      if (frame_contents.size) {
+        uint64_t t0 = stats_clock();
+        size_t start = 0;
+        if (bytes_to_skip)
+          start = min(frame_contents.size, bytes_to_skip);
+        size_t bytes_to_write =
+            start < frame_contents.size
+                ? min(frame_contents.size - start, file->size - bytes_written)
+                : 0;
+        stats_record(StageSlice, t0);
+
+        if (bytes_to_write) {
+          const unsigned char *const slice =
+              (const unsigned char *)frame_contents.data + start;
+          t0 = stats_clock();
+          write_ok = sparse_write(&output, slice, bytes_to_write) && write_ok;
+          stats_record(StageWrite, t0);
+          stats_add_bytes_written(bytes_to_write);
+          t0 = stats_clock();
+          afs_sha1_process(&sha1, slice, (unsigned long)bytes_to_write);
+          stats_record(StageHash, t0);
+          bytes_written += bytes_to_write;
+        }
+        bytes_to_skip -= start;
+      }
+    }
+
+    unsigned char digest[20];
+    char digest_str[41];
+    afs_sha1_done(&sha1, digest);
+    afs_sha1_hash_to_hex_string(digest, digest_str);
+    bool verified = bytes_written == (size_t)file->size &&
+                    (!file->checksum || !file->checksum[0] ||
+                     checksumEquals(digest_str, file->checksum));
+    write_ok = sparse_finish(&output) && write_ok;
+    bool synced = syncFile(output_file);
+    fclose(output_file);
+    if (!verified) {
+      boxing_log_args(BoxingLogLevelError,
+                      "Verification failed for %s (sha1: %s, expected: %s)",
+                      file->name, digest_str,
+                      file->checksum ? file->checksum : "");
+      ok = false;
+    } else if (!write_ok) {
+      boxing_log_args(BoxingLogLevelError, "Failed to write %s", file->name);
+      ok = false;
+    } else {
+      on_disk[i] = true;
+      if (!synced || !Journal_record(journal, i, file->size, file->checksum))
+        boxing_log_args(BoxingLogLevelWarning,
+                        "Failed to record %s in resume journal", file->name);
+    }
+  }
+  if (skipped)
+    boxing_log_args(BoxingLogLevelInfo,
+                    "Skipped %u file(s) already completed by a previous run",
+                    skipped);
+  if (copied)
+    boxing_log_args(BoxingLogLevelInfo,
+                    "Copied %u file(s) identical to another file instead of "
+                    "decoding them",
+                    copied);
+  afs_toc_data_free(toc);
+  free(on_disk);
+  free(originals);
+  free(shards);
+  return ok;
+}
+
+// The merge step of a sharded run: every file with frames has to be recorded
+// as complete in the journal of its shard, and still be on disk
+static bool checkShards(Slice toc_contents,
+                        const char *const restrict output_folder,
+                        const char *const restrict journal_prefix,
+                        unsigned count) {
+  afs_toc_data *toc = afs_toc_data_create();
+  if (!toc)
+    return false;
+  if (!afs_toc_data_load_string(toc, toc_contents.data)) {
+    afs_toc_data_free(toc);
+    return false;
+  }
+  afs_toc_data_reel *data_reel = afs_toc_data_reels_get_reel(toc->reels, 0);
+  unsigned files = afs_toc_data_reel_file_count(data_reel);
+  unsigned *shards = assignShards(data_reel, files, count);
+  unsigned *missing = calloc(count, sizeof *missing);
+  Journal journal = {.file = NULL, .entries = NULL, .entries_cap = 0};
+  for (unsigned s = 0; s < count; s++) {
+    char journal_path[4096];
+    snprintf(journal_path, sizeof journal_path, "%s_%uof%u.txt",
+             journal_prefix, s, count);
+    Journal_load(&journal, journal_path);
+  }
+  bool ok = shards && missing;
+  for (unsigned i = 0; ok && i < files; i++) {
+    afs_toc_file *file = afs_toc_data_reel_get_file_by_index(data_reel, i);
+    char output_file_path[4096];
+    snprintf(output_file_path, sizeof output_file_path, "%s/%s", output_folder,
+             file->name);
+    if (fileHasFrames(file) &&
+        !Journal_is_complete(&journal, i, file->size, file->checksum,
+                             output_file_path)) {
+      boxing_log_args(BoxingLogLevelError, "Shard %u/%u did not complete %s",
+                      shards[i], count, file->name);
+      missing[shards[i]]++;
+    }
+  }
+  const bool checked = ok;
+  for (unsigned s = 0; checked && s < count; s++) {
+    boxing_log_args(missing[s] ? BoxingLogLevelError : BoxingLogLevelInfo,
+                    "Shard %u/%u: %u file(s) missing", s, count, missing[s]);
+    ok = ok && !missing[s];
+  }
+  Journal_close(&journal);
+  free(missing);
+  free(shards);
+  afs_toc_data_free(toc);
+  return ok;
+}
+
+// The fast-start cache maps the fingerprint of frame 1 to the CRC of the
+// control frame it decodes to, as "<crc> <raw decoding>\n", so a warm start
+// reads the control frame from its cache instead of decoding frame 1. Returns
+// the control frame like Reel_unbox_control_frame, or empty on a miss.
+static Slice loadCachedControlFrame(const char *const restrict fingerprint_path,
+                                    const char *const restrict output_folder,
+                                    dcrc64 *dcrc64, bool *use_raw_decoding) {
+  Slice entry = mapFile(fingerprint_path);
+  if (!entry.data)
+    return Slice_empty;
+  char line[64];
+  const size_t line_len = min(entry.size, sizeof line - 1);
+  memcpy(line, entry.data, line_len);
+  line[line_len] = '\0';
+  unmapFile(entry);
+  uint64_t crc;
+  int raw;
+  if (sscanf(line, "%" SCNx64 " %d", &crc, &raw) != 2)
+    return Slice_empty;
+
+  char path[4096];
+  snprintf(path, sizeof path, "%s/control_frame_%" PRIx64 ".xml",
+           output_folder, crc);
+  Slice cached = mapFile(path);
+  if (!cached.data)
+    return Slice_empty;
+  Slice contents = {.data = malloc(cached.size + 1), .size = cached.size};
+  if (contents.data) {
+    memcpy(contents.data, cached.data, cached.size);
+    ((char *)contents.data)[contents.size] = '\0';
+  }
+  unmapFile(cached);
+  if (!contents.data)
+    return Slice_empty;
+  const uint64_t actual = boxing_math_crc64_calc_crc(
+      dcrc64, contents.data, (unsigned)contents.size);
+  boxing_math_crc64_reset(dcrc64, POLY_CRC_64);
+  if (actual != crc) {
+    free(contents.data);
+    return Slice_empty;
+  }
+  *use_raw_decoding = raw != 0;
+  return contents;
+}
+
+struct unbox_context {
+  unbox_options options;
+  BoxingLog log;
+  Stats stats;
+  Trace trace;
+  ImageArena arena; // frames are decoded into
+};
+
+// The library logs, records stages and allocates decoded images without a
+// context at hand, so a context is made current on the calling thread for the
+// duration of every call into it
+typedef struct {
+  BoxingLog *log;
+  Stats *stats;
+  Trace *trace;
+} ContextScope;
+
+static ContextScope contextEnter(unbox_context *context) {
+  return (ContextScope){
+      .log = boxing_log_set_current(&context->log),
+      .stats = stats_set_current(&context->stats),
+      .trace = trace_set_current(&context->trace),
+  };
+}
+
+static void contextLeave(const ContextScope previous) {
+  boxing_log_set_current(previous.log);
+  stats_set_current(previous.stats);
+  trace_set_current(previous.trace);
+}
+
+static void contextLogSink(void *user, enum BoxingLogLevel level,
+                           const char *message, size_t length) {
+  const unbox_context *context = user;
+  context->options.log_sink(context->options.log_user,
+                            (enum unbox_log_level)level, message, length);
+}
+
+void unbox_options_default(unbox_options *options) {
+  *options = (unbox_options){
+      .log_level = UNBOX_LOG_INFO,
+      .log_format = UNBOX_LOG_ANSI,
+      .log_sink = NULL,
+      .log_user = NULL,
+      .log_async = false,
+      .stats = false,
+      .trace = false,
+      .stream_buffer = 0,
+      .speculate_frames = 0,
+      .reader = UNBOX_READER_AUTO,
+      .dedup = UNBOX_DEDUP_COPY,
+      .shard_index = 0,
+      .shard_count = 1,
+  };
+}
+
+unbox_context *unbox_context_create(const unbox_options *options) {
+  unbox_context *context = calloc(1, sizeof *context);
+  if (!context)
+    return NULL;
+  context->options = *options;
+  if (!context->options.shard_count)
+    context->options.shard_count = 1;
+  context->log = (BoxingLog){
+      .threshold = (enum BoxingLogLevel)options->log_level,
+      .format = (enum BoxingLogFormat)options->log_format,
+      .sink = options->log_sink ? contextLogSink : NULL,
+      .sink_user = context,
+      .ring = NULL,
+  };
+  context->arena.reader.mode = (enum FileReadMode)options->reader;
+  const ContextScope previous = contextEnter(context);
+  // Keeps decoding off the path of stderr writes (or a slow sink)
+  if (options->log_async && !boxing_log_start_async(&context->log))
+    boxing_log(BoxingLogLevelWarning, "Failed to start logging thread");
+  if (options->stats)
+    stats_enable(&context->stats);
+  if (options->trace)
+    trace_enable(&context->trace, clock_now_ns());
+  contextLeave(previous);
+  return context;
+}
+
+void unbox_context_destroy(unbox_context *context) {
+  if (!context)
+    return;
+  boxing_log_stop_async(&context->log);
+  stats_free(&context->stats);
+  trace_free(&context->trace);
+  image_deinit(&context->arena);
+  free(context);
+}
+
+// Unboxes the control frame and TOC of the reel, then either its files or,
+// if `check_shards` is set, checks the journals of that many shards
+static bool unboxReel(unbox_context *context, const char *input_folder,
+                      const char *output_folder, unsigned check_shards) {
+  const unbox_options *options = &context->options;
+  bool ok = true;
+  dcrc64 *dcrc64 = boxing_math_crc64_create_def();
+  if (!dcrc64) {
+    boxing_log(BoxingLogLevelError, "Failed to create CRC64 instance");
+    return false;
+  }
+  Reel *reel = Reel_create(&context->arena);
+  if (!reel) {
+    boxing_math_crc64_free(dcrc64);
+    boxing_log(BoxingLogLevelError, "Failed to create reel");
+    return false;
+  }
+  reel->stream_limit = options->stream_buffer;
+  if (!Reel_init(reel, input_folder)) {
+    Reel_destroy(reel);
+    boxing_math_crc64_free(dcrc64);
+    boxing_log(
+        BoxingLogLevelError,
+        "Failed to init reel (Maybe no frames found in the current folder?)");
+    return false;
+  }
+  bool use_raw_decoding = false;
+  uint64_t fingerprint;
+  char fingerprint_path[4096] = "";
+  if (Reel_fingerprint(reel, &fingerprint))
+    snprintf(fingerprint_path, sizeof fingerprint_path,
+             "%s/fingerprint_%016" PRIx64 ".txt", output_folder, fingerprint);
+  Slice control_frame_contents =
+      fingerprint_path[0]
+          ? loadCachedControlFrame(fingerprint_path, output_folder, dcrc64,
+                                   &use_raw_decoding)
+          : Slice_empty;
+  const bool control_frame_cached = control_frame_contents.data != NULL;
+  // The TOC usually starts right after the control frame, its frames are
+  // decoded while the control frame is and used if the TOC range has them
+  if (!control_frame_cached && options->speculate_frames)
+    Reel_speculate(reel, 2, (int)min(options->speculate_frames, 65534u));
+  if (!control_frame_cached)
+    control_frame_contents = Reel_unbox_control_frame(reel, &use_raw_decoding);
+  if (control_frame_contents.data) {
+    uint64_t crc = boxing_math_crc64_calc_crc(
+        dcrc64, control_frame_contents.data,
+        (unsigned)control_frame_contents.size);
+    boxing_math_crc64_reset(dcrc64, POLY_CRC_64);
+    char cachefile_path[4096];
+    snprintf(cachefile_path, sizeof cachefile_path,
+             "%s/control_frame_%" PRIx64 ".xml", output_folder, crc);
+    if (!control_frame_cached) {
+      ensurePathExists(cachefile_path);
+      writeEntireFile(cachefile_path, control_frame_contents);
+    }
+    boxing_log_args(BoxingLogLevelInfo, "Control frame%s: %s",
+                    control_frame_cached ? " (cached)" : "", cachefile_path);
+    if (boxing_log_enabled(BoxingLogLevelInfo))
+      logControlFrame(control_frame_contents);
+    afs_control_data *ctl = afs_control_data_create();
+    if (afs_control_data_load_string(
+            ctl, (const char *)control_frame_contents.data)) {
+      if (!control_frame_cached && fingerprint_path[0]) {
+        char entry[64];
+        const int len = snprintf(entry, sizeof entry, "%016" PRIx64 " %d\n",
+                                 crc, use_raw_decoding ? 1 : 0);
+        // ignore failing to write cache
+        writeEntireFile(fingerprint_path,
+                        (Slice){.data = entry, .size = (size_t)len});
+      }
+      printReelInformation(ctl->administrative_metadata);
+      Unboxer unboxer;
+      // Payload storage reused by every frame
+      Slice payload = Slice_empty;
+      if (UnboxerCreate(
+              ctl->technical_metadata->afs_content_boxing_format->config,
+              use_raw_decoding, &unboxer) == UnboxerInitOK) {
+        Slice toc_contents = Slice_empty;
+        bool toc_contents_cached = false;
+        snprintf(cachefile_path, sizeof cachefile_path,
+                 "%s/toc_%" PRIx64 ".xml", output_folder, crc);
+        boxing_log_args(BoxingLogLevelInfo, "Checking for: %s",
+                        cachefile_path);
+        Slice cached_toc_contents = mapFile(cachefile_path);
+        if (cached_toc_contents.data) {
+          toc_contents = cached_toc_contents;
+          toc_contents_cached = true;
+        } else {
+          if (afs_toc_files_get_tocs_count(ctl->technical_metadata->afs_tocs) >
+              0) {
+            afs_toc_file *toc_file =
+                afs_toc_files_get_toc(ctl->technical_metadata->afs_tocs, 0);
+            toc_contents = Reel_unbox_toc(reel, &unboxer, &payload, toc_file);
+            // ignore failing to write cache
+            if (toc_contents.data)
+              writeEntireFile(cachefile_path, toc_contents);
+          } else {
+            boxing_log(BoxingLogLevelError,
+                       "No TOCs found in control frame data");
+            ok = false;
+          }
+        }
+        Reel_speculate_end(reel);
+        if (toc_contents.data) {
+          // Each shard keeps its own journal, they are merged when checking
+          const Shard shard = {.index = options->shard_index,
+                               .count = options->shard_count};
+          char journal_prefix[4096];
+          snprintf(journal_prefix, sizeof journal_prefix,
+                   "%s/journal_%" PRIx64, output_folder, crc);
+          if (shard.count > 1)
+            snprintf(cachefile_path, sizeof cachefile_path, "%s_%uof%u.txt",
+                     journal_prefix, shard.index, shard.count);
+          else
+            snprintf(cachefile_path, sizeof cachefile_path, "%s.txt",
+                     journal_prefix);
+          Journal journal = {.file = NULL, .entries = NULL, .entries_cap = 0};
+          if (check_shards) {
+            ok = checkShards(toc_contents, output_folder, journal_prefix,
+                             check_shards);
+          } else {
+            if (!Journal_open(&journal, cachefile_path))
+              boxing_log_args(BoxingLogLevelWarning,
+                              "Failed to open resume journal: %s",
+                              cachefile_path);
+            if (!unboxAndOutputFiles(reel, &unboxer, &payload, toc_contents,
+                                     output_folder, &journal, shard,
+                                     options->dedup)) {
+              boxing_log(BoxingLogLevelError, "Failed to unbox / output files");
+              ok = false;
+            }
+          }
+          Journal_close(&journal);
+          if (toc_contents_cached)
+            unmapFile(toc_contents);
+          else
+            free(toc_contents.data);
+        } else {
+          boxing_log(BoxingLogLevelError, "Failed to unbox TOC");
+          ok = false;
+        }
+        UnboxerDestroy(&unboxer);
+        free(payload.data);
+      } else {
+        boxing_log(BoxingLogLevelError, "Failed to create unboxer");
+        ok = false;
+      }
+    } else {
+      boxing_log(BoxingLogLevelError, "Failed to load control data");
+      ok = false;
+    }
+    afs_control_data_free(ctl);
+    free(control_frame_contents.data);
+  } else {
+    boxing_log(BoxingLogLevelError, "Failed to unbox control frame");
+    ok = false;
+  }
+  Reel_destroy(reel);
+  boxing_math_crc64_free(dcrc64);
+  return ok;
+}
+
+bool unbox_reel(unbox_context *context, const char *input,
+                const char *output_folder) {
+  const ContextScope previous = contextEnter(context);
+  const bool ok = unboxReel(context, input, output_folder, 0);
+  contextLeave(previous);
+  return ok;
+}
+
+bool unbox_check_shards(unbox_context *context, const char *input,
+                        const char *output_folder, unsigned count) {
+  const ContextScope previous = contextEnter(context);
+  const bool ok = count && unboxReel(context, input, output_folder, count);
+  contextLeave(previous);
+  return ok;
+}
+
+void unbox_write_stats_json(unbox_context *context, FILE *f) {
+  stats_write_json(&context->stats, f);
+}
+
+bool unbox_write_trace(unbox_context *context, const char *path) {
+  return context->trace.enabled && trace_write(&context->trace, path);
+}
+
+bool unbox_parse_log_level(const char *name, enum unbox_log_level *out) {
+  enum BoxingLogLevel level;
+  if (!boxing_log_parse_level(name, &level))
+    return false;
+  *out = (enum unbox_log_level)level;
+  return true;
+}
+
+bool unbox_parse_log_format(const char *name, enum unbox_log_format *out) {
+  enum BoxingLogFormat format;
+  if (!boxing_log_parse_format(name, &format))
+    return false;
+  *out = (enum unbox_log_format)format;
+  return true;
+}
+
+bool unbox_parse_dedup(const char *name, enum unbox_dedup *out) {
+  static const char *const names[] = {"off", "copy", "hardlink"};
+  for (unsigned i = 0; i < countof(names); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      *out = (enum unbox_dedup)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool unbox_parse_reader(const char *name, enum unbox_reader *out) {
+  enum FileReadMode mode;
+  if (!file_read_parse_mode(name, &mode))
+    return false;
+  *out = (enum unbox_reader)mode;
+  return true;
+}
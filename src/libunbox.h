@@ -0,0 +1,98 @@
+#ifndef LIBUNBOX_H
+#define LIBUNBOX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// libunbox decodes the files of a reel (a folder of scanned frames, a .raw
+// reel, a tar archive or a .raw stream) into an output folder. Everything a
+// run needs lives in an unbox_context, so a process can keep contexts around
+// and run several reels at once, one thread per context at a time.
+
+// In order of severity, except that UNBOX_LOG_DEBUG sorts below info. As a
+// log level UNBOX_LOG_ALWAYS only lets through the messages logged at it.
+enum unbox_log_level {
+  UNBOX_LOG_INFO,
+  UNBOX_LOG_WARNING,
+  UNBOX_LOG_ERROR,
+  UNBOX_LOG_FATAL,
+  UNBOX_LOG_ALWAYS, // reel information, shown at any other level
+  UNBOX_LOG_DEBUG,  // every decoded frame
+};
+
+enum unbox_log_format {
+  UNBOX_LOG_ANSI,  // colored level, messages as-is
+  UNBOX_LOG_PLAIN, // no escape sequences
+  UNBOX_LOG_JSON,  // one JSON object per line
+};
+
+// How frame image files are read, see unbox_options.reader
+enum unbox_reader {
+  UNBOX_READER_MMAP,   // map every file
+  UNBOX_READER_PREAD,  // read into a buffer reused by every file
+  UNBOX_READER_DIRECT, // like pread, bypassing the page cache
+  UNBOX_READER_AUTO,   // pread on network filesystems, mmap elsewhere
+};
+
+// How files identical to an earlier file of the TOC (same checksum and size)
+// are written instead of decoding them again
+enum unbox_dedup {
+  UNBOX_DEDUP_OFF,      // decode every file
+  UNBOX_DEDUP_COPY,     // shared extents where the filesystem has them
+  UNBOX_DEDUP_HARDLINK, // hard links, so the copies are the same file
+};
+
+// Gets every message of a context at or above its log level, unformatted (no
+// color escapes, whatever the log format) and not NUL-terminated
+typedef void (*unbox_log_sink)(void *user, enum unbox_log_level level,
+                               const char *message, size_t length);
+
+typedef struct {
+  enum unbox_log_level log_level;
+  enum unbox_log_format log_format; // of messages written to stderr
+  unbox_log_sink log_sink;          // NULL to write messages to stderr
+  void *log_user;
+  bool log_async; // pass messages on from a background thread
+  bool stats;     // time every frame stage, see unbox_write_stats_json
+  bool trace;     // record every frame stage, see unbox_write_trace
+  size_t stream_buffer; // bytes of frames a .raw stream may hold, 0: 1 GiB
+  // Frames after the control frame to decode on another thread while the
+  // control frame is unboxed, in case they hold the TOC, 0: none. At most 4
+  // decoded frames are held ahead of the ones used.
+  unsigned speculate_frames;
+  enum unbox_reader reader; // of frame files in folders, archives are mapped
+  enum unbox_dedup dedup;
+  unsigned shard_index; // unbox only the files of this shard
+  unsigned shard_count; // of the TOC's files, balanced by frames, 1: all
+} unbox_options;
+
+typedef struct unbox_context unbox_context;
+
+void unbox_options_default(unbox_options *options);
+
+// NULL if out of memory
+unbox_context *unbox_context_create(const unbox_options *options);
+void unbox_context_destroy(unbox_context *context);
+
+// Unboxes the files of the reel at `input` into `output_folder`, or of the
+// .raw stream on stdin for "-". Files completed by an earlier run into the
+// same folder are skipped. Returns false if any file failed.
+bool unbox_reel(unbox_context *context, const char *input,
+                const char *output_folder);
+
+// Checks that every file of the reel was completed by one of `count` shard
+// runs into `output_folder`
+bool unbox_check_shards(unbox_context *context, const char *input,
+                        const char *output_folder, unsigned count);
+
+// Single line of JSON with per stage timings and throughput of all runs
+void unbox_write_stats_json(unbox_context *context, FILE *f);
+bool unbox_write_trace(unbox_context *context, const char *path);
+
+bool unbox_parse_log_level(const char *name, enum unbox_log_level *out);
+bool unbox_parse_log_format(const char *name, enum unbox_log_format *out);
+bool unbox_parse_reader(const char *name, enum unbox_reader *out);
+bool unbox_parse_dedup(const char *name, enum unbox_dedup *out);
+
+#endif
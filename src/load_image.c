@@ -1,16 +1,40 @@
 #include "map_file.c"
+#include "read_file.c"
+#include "stats.c"
+#include "threads.c"
 #include "unboxing_log.c"
-#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-static void *memory = NULL;
-static size_t used = 0;
+// Images are decoded into an arena that is reset for every image, so an image
+// is valid until the next one is decoded into the same arena. Threads decoding
+// at the same time need an arena each. The arena memory is allocated by the
+// first decode and freed by image_deinit, like the buffer image files are
+// read into.
+typedef struct {
+  void *memory;
+  size_t used;
+  FileReader reader;
+  // One byte of a 1 or 2-bit PNG scanline expanded to 8-bit pixels, scaled
+  // like stb_image does
+  uint8_t expand_1bit[256][8];
+  uint8_t expand_2bit[256][4];
+} ImageArena;
 #define MEMORY_SIZE (256ul * 1024ul * 1024ul)
 
-static void image_reset(void) { used = 0; }
+// stb_image allocates from the arena of the decode running on its thread
+static THREAD_LOCAL ImageArena *image_arena;
+
+static void image_reset(ImageArena *arena) { arena->used = 0; }
 
-static void image_deinit(void) { free(memory); }
+static void image_deinit(ImageArena *arena) {
+  free(arena->memory);
+  arena->memory = NULL;
+  arena->used = 0;
+  file_read_free(&arena->reader);
+}
 
 // Debug image memory allocations
 #if 1
@@ -25,30 +49,38 @@ static const char *empty = "..................................................."
                            "...........................";
 static void print_used(void) {
   putchar('[');
-  unsigned frac = ((float)used / (float)MEMORY_SIZE) * (float)78;
+  unsigned frac = ((float)image_arena->used / (float)MEMORY_SIZE) * (float)78;
   printf("%.*s", frac, full);
   printf("%.*s", 78 - frac, empty);
-  printf("] %9zu/%9zu\n", used, MEMORY_SIZE);
+  printf("] %9zu/%9zu\n", image_arena->used, MEMORY_SIZE);
 }
 #endif
 
-static void image_init(void) {
-  memory = malloc(MEMORY_SIZE);
-  assert(memory);
-  atexit(image_deinit);
+static bool image_init(ImageArena *arena) {
+  arena->memory = malloc(MEMORY_SIZE);
+  arena->used = 0;
+  if (!arena->memory)
+    return false;
+  for (unsigned b = 0; b < 256; b++) {
+    for (unsigned i = 0; i < 8; i++)
+      arena->expand_1bit[b][i] = (uint8_t)(((b >> (7 - i)) & 1) * 255);
+    for (unsigned i = 0; i < 4; i++)
+      arena->expand_2bit[b][i] = (uint8_t)(((b >> (6 - i * 2)) & 3) * 85);
+  }
+  return true;
 }
 
 static void *image_malloc(const size_t size) {
   const size_t mask = 16u - 1u;
-  const size_t start = (size_t)memory + used;
+  const size_t start = (size_t)image_arena->memory + image_arena->used;
   const size_t aligned = (start + mask) & ~mask;
   const size_t offset = aligned - start;
   const size_t aligned_size = size + offset;
-  if (used + aligned_size > MEMORY_SIZE) {
+  if (image_arena->used + aligned_size > MEMORY_SIZE) {
     image_debug_printf("image_malloc(%zu): %p\n", size, NULL);
     return NULL;
   }
-  used += aligned_size;
+  image_arena->used += aligned_size;
   print_used();
   image_debug_printf("image_malloc(%zu): %p\n", size, (void *)aligned);
   return (void *)aligned;
@@ -61,20 +93,20 @@ static void *image_realloc_sized(void *const p, const size_t old_size,
                        new_size, p);
     return p;
   }
-  if ((size_t)memory + used - old_size == (size_t)p) {
+  if ((size_t)image_arena->memory + image_arena->used - old_size == (size_t)p) {
     if (new_size < old_size) {
-      used -= old_size - new_size;
+      image_arena->used -= old_size - new_size;
       print_used();
       image_debug_printf("image_realloc_sized(%p, %zu, %zu): %p\n", p, old_size,
                          new_size, p);
       return p;
     }
-    if (used + new_size - old_size > MEMORY_SIZE) {
+    if (image_arena->used + new_size - old_size > MEMORY_SIZE) {
       image_debug_printf("image_realloc_sized(%p, %zu, %zu): %p\n", p, old_size,
                          new_size, NULL);
       return NULL;
     }
-    used += new_size - old_size;
+    image_arena->used += new_size - old_size;
     print_used();
     image_debug_printf("image_realloc_sized(%p, %zu, %zu): %p\n", p, old_size,
                        new_size, p);
@@ -123,26 +155,173 @@ typedef struct {
   int height;
 } Image;
 
-// Allocating an image registers an atexit() handler to free it. There is no
-// unloadImage. Process exit will unload the last loaded image. loading a new
-// image will unload the previously loaded image.
-static Image loadImage(const char *const restrict path) {
-  Slice file = mapFile(path);
-  image_debug_printf("file.data: %p\n", file.data);
-  if (file.data == NULL)
-    return (Image){.data = NULL, .width = 0, .height = 0};
+static inline uint32_t png_u32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         p[3];
+}
+
+static inline uint8_t png_paeth(const int a, const int b, const int c) {
+  const int p = a + b - c;
+  const int pa = abs(p - a);
+  const int pb = abs(p - b);
+  const int pc = abs(p - c);
+  return (uint8_t)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+// Reverses the filter of a scanline in place. Filters work on whole bytes,
+// one byte to the left for bit depths below 8.
+static bool png_unfilter(const uint8_t filter, uint8_t *const restrict row,
+                         const uint8_t *const restrict prior,
+                         const size_t stride) {
+  switch (filter) {
+  case 0:
+    break;
+  case 1:
+    for (size_t x = 1; x < stride; x++)
+      row[x] = (uint8_t)(row[x] + row[x - 1]);
+    break;
+  case 2:
+    for (size_t x = 0; prior && x < stride; x++)
+      row[x] = (uint8_t)(row[x] + prior[x]);
+    break;
+  case 3:
+    for (size_t x = 0; x < stride; x++)
+      row[x] = (uint8_t)(row[x] + (((x ? row[x - 1] : 0) +
+                                    (prior ? prior[x] : 0)) >>
+                                   1));
+    break;
+  case 4:
+    for (size_t x = 0; x < stride; x++)
+      row[x] = (uint8_t)(row[x] + png_paeth(x ? row[x - 1] : 0,
+                                            prior ? prior[x] : 0,
+                                            x && prior ? prior[x - 1] : 0));
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+// stb_image expands 1 and 2-bit grayscale PNGs one pixel at a time. These are
+// inflated straight into the arena here and expanded a byte at a time through
+// lookup tables instead. Returns NULL for any other PNG, which is left to
+// stb_image, and for malformed files, so stb_image reports the error.
+static unsigned char *loadPngLowDepth(const Slice file, int *width,
+                                      int *height) {
+  const uint8_t *const p = (const uint8_t *)file.data;
+  if (file.size < 8 + 25 || memcmp(p, "\x89PNG\r\n\x1a\n", 8) != 0 ||
+      png_u32(p + 8) != 13 || memcmp(p + 12, "IHDR", 4) != 0)
+    return NULL;
+  const uint8_t *const ihdr = p + 16;
+  const uint32_t w = png_u32(ihdr);
+  const uint32_t h = png_u32(ihdr + 4);
+  const uint8_t depth = ihdr[8];
+  if ((depth != 1 && depth != 2) || ihdr[9] != 0 || ihdr[12] != 0 || !w ||
+      !h || w > (1u << 16) || h > (1u << 16) || w % (8u / depth) != 0)
+    return NULL;
+
+  // Usually a single IDAT, otherwise they are joined
+  const uint8_t *idat = NULL;
+  size_t idat_size = 0;
+  uint8_t *joined = NULL;
+  size_t i = 8 + 25;
+  bool end = false;
+  while (!end && i + 12 <= file.size) {
+    const uint32_t size = png_u32(p + i);
+    const uint8_t *const type = p + i + 4;
+    if (size > file.size - i - 12)
+      return NULL;
+    if (memcmp(type, "IDAT", 4) == 0) {
+      if (idat && !joined) {
+        if (!(joined = image_malloc(file.size)))
+          return NULL;
+        memcpy(joined, idat, idat_size);
+        idat = joined;
+      }
+      if (joined)
+        memcpy(joined + idat_size, p + i + 8, size);
+      else
+        idat = p + i + 8;
+      idat_size += size;
+    } else if (memcmp(type, "IEND", 4) == 0) {
+      end = true;
+    } else if (!(type[0] & 0x20)) {
+      return NULL; // unexpected critical chunk
+    }
+    i += 12 + (size_t)size;
+  }
+  const size_t stride = (size_t)w * depth / 8;
+  const size_t scanlines_size = (stride + 1) * h;
+  if (!end || !idat || scanlines_size > INT32_MAX || idat_size > INT32_MAX)
+    return NULL;
+
+  uint8_t *const scanlines = image_malloc(scanlines_size);
+  uint8_t *const out = image_malloc((size_t)w * h);
+  if (!scanlines || !out ||
+      stbi_zlib_decode_buffer((char *)scanlines, (int)scanlines_size,
+                              (const char *)idat,
+                              (int)idat_size) != (int)scanlines_size)
+    return NULL;
+
+  for (uint32_t y = 0; y < h; y++) {
+    uint8_t *const row = scanlines + y * (stride + 1) + 1;
+    if (!png_unfilter(row[-1], row, y ? row - stride - 1 : NULL, stride))
+      return NULL;
+    uint8_t *const dst = out + (size_t)y * w;
+    if (depth == 1) {
+      for (size_t x = 0; x < stride; x++)
+        memcpy(dst + x * 8, image_arena->expand_1bit[row[x]], 8);
+    } else {
+      for (size_t x = 0; x < stride; x++)
+        memcpy(dst + x * 4, image_arena->expand_2bit[row[x]], 4);
+    }
+  }
+  *width = (int)w;
+  *height = (int)h;
+  return out;
+}
+
+// Decodes an image file held in memory into `arena`, `name` is only used for
+// logging. There is no unloadImage, decoding the next image into the arena
+// unloads the previous one.
+static Image decodeImage(ImageArena *arena, const Slice file,
+                         const char *const restrict name) {
   int width;
   int height;
-  if (memory == NULL)
-    image_init();
-  else
-    image_reset();
-  unsigned char *data = stbi_load_from_memory(
-      (unsigned char *)file.data, (int)file.size, &width, &height, NULL, 1);
-  unmapFile(file);
+  if (arena->memory == NULL) {
+    if (!image_init(arena)) {
+      boxing_log_args(BoxingLogLevelError, "Out of memory decoding %s", name);
+      return (Image){.data = NULL, .width = 0, .height = 0};
+    }
+  } else {
+    image_reset(arena);
+  }
+  ImageArena *const previous = image_arena;
+  image_arena = arena;
+  const uint64_t t0 = stats_clock();
+  unsigned char *data = loadPngLowDepth(file, &width, &height);
+  if (!data) {
+    image_reset(arena);
+    data = stbi_load_from_memory((unsigned char *)file.data, (int)file.size,
+                                 &width, &height, NULL, 1);
+  }
+  stats_record(StageInflate, t0);
+  image_arena = previous;
   if (data)
     return (Image){.data = data, .width = width, .height = height};
-  boxing_log_args(BoxingLogLevelError, "Failed during loading of %s: %s", path,
+  boxing_log_args(BoxingLogLevelError, "Failed during loading of %s: %s", name,
                   stbi_failure_reason());
   return (Image){.data = NULL, .width = 0, .height = 0};
 }
+
+static Image loadImage(ImageArena *arena, const char *const restrict path) {
+  uint64_t t0 = stats_clock();
+  Slice file = file_read(&arena->reader, path);
+  stats_record(StageMap, t0);
+  image_debug_printf("file.data: %p\n", file.data);
+  if (file.data == NULL)
+    return (Image){.data = NULL, .width = 0, .height = 0};
+  Image image = decodeImage(arena, file, path);
+  file_read_release(&arena->reader, file);
+  return image;
+}
@@ -1,277 +1,199 @@
-#include "reel.c"
-#include "types.h"
-#include "unboxing_log.c"
-#include <boxing/config.h>
-#include <boxing/math/crc64.h>
-#include <boxing/unboxer.h>
-#include <controldata.h>
-#include <inttypes.h>
-#include <mxml.h>
+// Command line client of libunbox
+
+#include "libunbox.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/stat.h>
+#include <string.h>
 #ifdef _WIN32
 #include "win32.h"
 #endif
 
-static bool writePathSegment(const char *const restrict input, Slice scratch,
-                             unsigned *restrict cursor) {
-  const size_t input_len = strlen(input);
-  for (size_t i = 0; i < *cursor; i++)
-    ((char *)scratch.data)[i] = input[i];
-  size_t j;
-  for (j = *cursor; j < input_len && j < scratch.size; j++) {
-    if (input[j] == '/') {
-      *cursor = (unsigned)j + 1;
-      return true;
-    }
-    ((char *)scratch.data)[j] = input[j];
-  }
-  ((char *)scratch.data)[j] = '\0';
-  return false;
-}
-
-static void ensurePathExists(const char *const restrict path) {
-  char buf[256] = {0};
-  unsigned cursor = 0;
-  for (;;) {
-    if (writePathSegment(path, sliceof(buf), &cursor)) {
-      mkdir(buf, 0755);
-    } else
-      break;
-  }
-}
-
-static void printReelInformation(afs_administrative_metadata *md) {
-  boxing_log(BoxingLogLevelAlways, "");
-  boxing_log_args(BoxingLogLevelAlways, "Reel ID: %s", md->reel_id);
-  boxing_log_args(BoxingLogLevelAlways, "Print Reel ID: %s", md->print_reel_id);
-  boxing_log_args(BoxingLogLevelAlways, "Title: %s", md->title);
-  boxing_log_args(BoxingLogLevelAlways, "Description: %s", md->description);
-  boxing_log_args(BoxingLogLevelAlways, "Creator: %s", md->creator);
-  boxing_log_args(BoxingLogLevelAlways, "Creation Date: %s", md->creation_date);
-  boxing_log(BoxingLogLevelAlways, "");
-}
-
-static bool writeEntireFile(const char *const restrict file_path, Slice data) {
-  FILE *f = fopen(file_path, "wb");
-  size_t total_written = 0;
-  while (total_written < data.size) {
-    size_t written = fwrite((const char *)data.data + total_written, 1,
-                            data.size - total_written, f);
-    if (written == 0) {
-      fclose(f);
-      return false;
-    }
-    total_written += written;
-  }
-  fclose(f);
-  return true;
+typedef struct {
+  const char *input_folder;
+  const char *output_folder;
+  const char *trace_path;
+  const char *stats_path; // stats report file, or NULL for stdout
+  unbox_options unbox;
+  unsigned check_shards; // shard count to check instead of unboxing, or 0
+} Options;
+
+static const char *const usage =
+    "Usage: %s [options] <input folder with scanned images, .raw reel or "
+    "tar archive> <output folder to place unboxed files>\n"
+    "       %s [options] - <output folder>  (stream a .raw reel from stdin)\n"
+    "Options:\n"
+    "  --log-level=<debug|info|warning|error|fatal|quiet>  (default: info)\n"
+    "  --log-format=<ansi|plain|json>                (default: ansi)\n"
+    "  --reader=<mmap|pread|direct|auto>  How frame files are read "
+    "(default: auto)\n"
+    "  --stats=json[:<file>]  Write per-stage timings and throughput to "
+    "stdout, or to <file>, at the end of the run\n"
+    "  --trace <file.json>  Write a Chrome / Perfetto trace of every frame "
+    "stage\n"
+    "  --stream-buffer=<MiB>  Frames a streamed reel may hold on to "
+    "(default: 1024)\n"
+    "  --dedup=<off|copy|hardlink>  Decode identical files once, write the "
+    "others as copies or hard links (default: copy)\n"
+    "  --speculate=<frames>  Decode this many frames after the control "
+    "frame ahead, in case they hold the TOC, at most 4 held at a time "
+    "(default: 0)\n"
+    "  --shard=<i>/<N>  Only unbox shard i (from 0) of N, split by frames\n"
+    "  --check-shards=<N>  Check that all N shards completed\n";
+
+// Returns the value of `--name=value` options, or NULL if `arg` is not `name`
+static const char *optionValue(const char *const restrict arg,
+                               const char *const restrict name) {
+  const size_t name_len = strlen(name);
+  if (strncmp(arg, name, name_len) != 0 || arg[name_len] != '=')
+    return NULL;
+  return arg + name_len + 1;
 }
 
-static bool unboxAndOutputFiles(Reel *reel, Unboxer *unboxer,
-                                Slice toc_contents,
-                                const char *const restrict output_folder) {
-  afs_toc_data *toc = afs_toc_data_create();
-  if (!toc)
-    return false;
-  if (!afs_toc_data_load_string(toc, toc_contents.data)) {
-    afs_toc_data_free(toc);
-    return false;
-  }
-  afs_toc_data_reel *data_reel = afs_toc_data_reels_get_reel(toc->reels, 0);
-  unsigned files = afs_toc_data_reel_file_count(data_reel);
-  char buf[4096];
-  for (unsigned i = 0; i < files; i++) {
-    afs_toc_file *file = afs_toc_data_reel_get_file_by_index(data_reel, i);
-    if (!(file->types & AFS_TOC_FILE_TYPE_DIGITAL)) {
-      printf("skipping non-digital file: %s\n", file->name);
-      continue;
-    }
-    printf("%d[%d]..%d[%d] (size: %" PRId64 ") %s (%s) [%s]\n",
-           file->start_frame, file->start_byte, file->end_frame, file->end_byte,
-           file->size, file->name, file->checksum, file->file_format);
-
-    char output_file_path[4096];
-    snprintf(output_file_path, sizeof output_file_path, "%s/%s", output_folder,
-             file->name);
-    ensurePathExists(output_file_path);
-
-    if (strncmp(file->file_format, "afs/directory", 13) == 0) {
-      // directory names always end with /, ensurePathExists already created
-      // this directory, or if not, this implementation creates the entire
-      // parent path of each file anyway.
-      continue;
-    }
-
-    FILE *output_file = fopen(output_file_path, "w+b");
-
-    if (!output_file) {
-      afs_toc_data_free(toc);
-      return false;
-    }
-
-    boxing_unboxer_reset(unboxer->unboxer);
-
-    size_t bytes_written = 0;
-    size_t bytes_to_skip = file->start_byte;
-    for (int f = file->start_frame; f <= file->end_frame; f++) {
-      if (!reel->frames[f]) {
-        afs_toc_data_free(toc);
+static bool parseOptions(int argc, char *argv[], Options *out) {
+  *out = (Options){
+      .input_folder = NULL,
+      .output_folder = NULL,
+      .trace_path = NULL,
+      .stats_path = NULL,
+      .check_shards = 0,
+  };
+  unbox_options_default(&out->unbox);
+  // Decoding is noisy at info level, keep stderr writes off the decode path
+  out->unbox.log_async = true;
+  unsigned positional = 0;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value;
+    if ((value = optionValue(arg, "--log-level"))) {
+      if (!unbox_parse_log_level(value, &out->unbox.log_level)) {
+        fprintf(stderr, "Invalid log level: %s\n", value);
         return false;
       }
-      Slice frame_contents;
-      sprintf(buf, "%s/%s", reel->directory_path,
-              (const char *)reel->string_pool.data + reel->frames[f] - 1);
-      Image data_frame = loadImage(buf);
-      if (!data_frame.data) {
-        afs_toc_data_free(toc);
+    } else if ((value = optionValue(arg, "--log-format"))) {
+      if (!unbox_parse_log_format(value, &out->unbox.log_format)) {
+        fprintf(stderr, "Invalid log format: %s\n", value);
         return false;
       }
-
-      if (UnboxerUnbox(unboxer, data_frame.data, data_frame.width,
-                       data_frame.height, BOXING_METADATA_CONTENT_TYPES_DATA,
-                       &frame_contents) != UnboxOK) {
-        afs_toc_data_free(toc);
+    } else if ((value = optionValue(arg, "--reader"))) {
+      if (!unbox_parse_reader(value, &out->unbox.reader)) {
+        fprintf(stderr, "Invalid reader: %s\n", value);
         return false;
       }
-      if (frame_contents.size) {
-        size_t start = 0;
-        if (bytes_to_skip)
-          start = min(frame_contents.size, bytes_to_skip);
-
-        if (start < frame_contents.size) {
-          size_t bytes_to_write =
-              min(frame_contents.size - start, file->size - bytes_written);
-          fwrite((const char *)frame_contents.data + start, 1, bytes_to_write,
-                 output_file);
-          free(frame_contents.data);
-          bytes_written += bytes_to_write;
-        }
-        bytes_to_skip -= start;
+    } else if ((value = optionValue(arg, "--dedup"))) {
+      if (!unbox_parse_dedup(value, &out->unbox.dedup)) {
+        fprintf(stderr, "Invalid dedup mode: %s\n", value);
+        return false;
+      }
+    } else if ((value = optionValue(arg, "--stats"))) {
+      if (strncmp(value, "json", 4) != 0 ||
+          (value[4] && (value[4] != ':' || !value[5]))) {
+        fprintf(stderr, "Invalid stats format: %s\n", value);
+        return false;
+      }
+      out->stats_path = value[4] ? value + 5 : NULL;
+      out->unbox.stats = true;
+    } else if ((value = optionValue(arg, "--trace"))) {
+      out->trace_path = value;
+      out->unbox.trace = true;
+    } else if ((value = optionValue(arg, "--stream-buffer"))) {
+      char *end;
+      const unsigned long mib = strtoul(value, &end, 10);
+      if (end == value || *end || !mib || mib > SIZE_MAX >> 20) {
+        fprintf(stderr, "Invalid stream buffer: %s\n", value);
+        return false;
+      }
+      out->unbox.stream_buffer = (size_t)mib << 20;
+    } else if ((value = optionValue(arg, "--speculate"))) {
+      char *end;
+      const unsigned long frames = strtoul(value, &end, 10);
+      if (end == value || *end || frames > 65534) {
+        fprintf(stderr, "Invalid speculate frame count: %s\n", value);
+        return false;
+      }
+      out->unbox.speculate_frames = (unsigned)frames;
+    } else if ((value = optionValue(arg, "--shard"))) {
+      char *end;
+      const unsigned long index = strtoul(value, &end, 10);
+      const unsigned long count =
+          *end == '/' ? strtoul(end + 1, &end, 10) : 0;
+      if (*end || !count || count > 65535 || index >= count) {
+        fprintf(stderr, "Invalid shard: %s\n", value);
+        return false;
+      }
+      out->unbox.shard_index = (unsigned)index;
+      out->unbox.shard_count = (unsigned)count;
+    } else if ((value = optionValue(arg, "--check-shards"))) {
+      char *end;
+      const unsigned long count = strtoul(value, &end, 10);
+      if (end == value || *end || !count || count > 65535) {
+        fprintf(stderr, "Invalid shard count: %s\n", value);
+        return false;
       }
+      out->check_shards = (unsigned)count;
+    } else if (strcmp(arg, "--trace") == 0) {
+      if (++i >= argc)
+        return false;
+      out->trace_path = argv[i];
+      out->unbox.trace = true;
+    } else if (strncmp(arg, "--", 2) == 0) {
+      fprintf(stderr, "Unknown option: %s\n", arg);
+      return false;
+    } else if (positional == 0) {
+      out->input_folder = arg;
+      positional++;
+    } else if (positional == 1) {
+      out->output_folder = arg;
+      positional++;
+    } else {
+      fprintf(stderr, "Unexpected argument: %s\n", arg);
+      return false;
     }
-    fclose(output_file);
-    // TODO: consider using sha1.c to output sha1 of the written file here
   }
-  afs_toc_data_free(toc);
-  return true;
+  return positional == 2;
 }
 
+
 int main(int argc, char *argv[]) {
 #ifdef _WIN32
   SetConsoleOutputCP(CP_UTF8);
 #endif
-  if (argc < 3) {
-    boxing_log_args(
-        BoxingLogLevelError,
-        "Usage: %s <input folder with scanned images> <output folder to "
-        "place unboxed files>\n",
-        argv[0]);
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    fprintf(stderr, usage, argv[0], argv[0]);
     return EXIT_FAILURE;
   }
 
-  const char *input_folder = argv[1];
-  const char *output_folder = argv[2];
-
-  int status = EXIT_SUCCESS;
-  dcrc64 *dcrc64 = boxing_math_crc64_create_def();
-  if (!dcrc64) {
-    boxing_log(BoxingLogLevelError, "Failed to create CRC64 instance");
+  unbox_context *context = unbox_context_create(&options.unbox);
+  if (!context) {
+    fprintf(stderr, "Out of memory\n");
     return EXIT_FAILURE;
   }
-  Reel *reel = Reel_create();
-  if (!reel) {
-    boxing_math_crc64_free(dcrc64);
-    boxing_log(BoxingLogLevelError, "Failed to create reel");
-    return EXIT_FAILURE;
-  }
-  if (!Reel_init(reel, input_folder)) {
-    Reel_destroy(reel);
-    boxing_math_crc64_free(dcrc64);
-    boxing_log(
-        BoxingLogLevelError,
-        "Failed to init reel (Maybe no frames found in the current folder?)");
-    return EXIT_FAILURE;
+  bool ok = options.check_shards
+                ? unbox_check_shards(context, options.input_folder,
+                                     options.output_folder,
+                                     options.check_shards)
+                : unbox_reel(context, options.input_folder,
+                             options.output_folder);
+  if (options.trace_path && !unbox_write_trace(context, options.trace_path)) {
+    fprintf(stderr, "Failed to write trace: %s\n", options.trace_path);
+    ok = false;
   }
-  bool use_raw_decoding;
-  Slice control_frame_contents =
-      Reel_unbox_control_frame(reel, &use_raw_decoding);
-  if (control_frame_contents.data) {
-    printf("%.*s\n", (int)control_frame_contents.size,
-           (char *)control_frame_contents.data);
-    uint64_t crc = boxing_math_crc64_calc_crc(
-        dcrc64, control_frame_contents.data, (unsigned)control_frame_contents.size);
-    boxing_math_crc64_reset(dcrc64, POLY_CRC_64);
-    char cachefile_path[4096];
-    snprintf(cachefile_path, sizeof cachefile_path,
-             "%s/control_frame_%" PRIx64 ".xml", output_folder, crc);
-    ensurePathExists(cachefile_path);
-    writeEntireFile(cachefile_path, control_frame_contents);
-    afs_control_data *ctl = afs_control_data_create();
-    if (afs_control_data_load_string(
-            ctl, (const char *)control_frame_contents.data)) {
-      printReelInformation(ctl->administrative_metadata);
-      Unboxer unboxer;
-      if (UnboxerCreate(
-              ctl->technical_metadata->afs_content_boxing_format->config,
-              use_raw_decoding, &unboxer) == UnboxerInitOK) {
-        Slice toc_contents = Slice_empty;
-        bool toc_contents_cached = false;
-        snprintf(cachefile_path, sizeof cachefile_path,
-                 "%s/toc_%" PRIx64 ".xml", output_folder, crc);
-        printf("checking for: %s\n", cachefile_path);
-        Slice cached_toc_contents = mapFile(cachefile_path);
-        if (cached_toc_contents.data) {
-          toc_contents = cached_toc_contents;
-          toc_contents_cached = true;
-        } else {
-          if (afs_toc_files_get_tocs_count(ctl->technical_metadata->afs_tocs) >
-              0) {
-            afs_toc_file *toc_file =
-                afs_toc_files_get_toc(ctl->technical_metadata->afs_tocs, 0);
-            toc_contents = Reel_unbox_toc(reel, &unboxer, toc_file);
-            // ignore failing to write cache
-            if (toc_contents.data)
-              writeEntireFile(cachefile_path, toc_contents);
-          } else {
-            boxing_log(BoxingLogLevelError,
-                       "No TOCs found in control frame data");
-            status = EXIT_FAILURE;
-          }
-        }
-        if (toc_contents.data) {
-          if (!unboxAndOutputFiles(reel, &unboxer, toc_contents,
-                                   output_folder)) {
-            boxing_log(BoxingLogLevelError, "Failed to unbox / output files");
-            status = EXIT_FAILURE;
-          }
-          if (toc_contents_cached)
-            unmapFile(toc_contents);
-          else
-            free(toc_contents.data);
-        } else {
-          boxing_log(BoxingLogLevelError, "Failed to unbox TOC");
-          status = EXIT_FAILURE;
-        }
-        UnboxerDestroy(&unboxer);
-      } else {
-        boxing_log(BoxingLogLevelError, "Failed to create unboxer");
-        status = EXIT_FAILURE;
-      }
-    } else {
-      boxing_log(BoxingLogLevelError, "Failed to load control data");
-      status = EXIT_FAILURE;
+  // On stdout the report comes first, so it is the first line of the output
+  if (options.unbox.stats) {
+    FILE *f = options.stats_path ? fopen(options.stats_path, "wb") : stdout;
+    if (f) {
+      unbox_write_stats_json(context, f);
+      if (f != stdout && fclose(f) != 0)
+        f = NULL;
+    }
+    if (!f) {
+      fprintf(stderr, "Failed to write stats: %s\n", options.stats_path);
+      ok = false;
     }
-    afs_control_data_free(ctl);
-    free(control_frame_contents.data);
-  } else {
-    boxing_log(BoxingLogLevelError, "Failed to unbox control frame");
-    status = EXIT_FAILURE;
   }
-  Reel_destroy(reel);
-  boxing_math_crc64_free(dcrc64);
-  printf("\x1b[%dm%s\x1b[0m\n", status ? 91 : 92, status ? "FAILED" : "OK");
-  return status;
+  printf("\x1b[%dm%s\x1b[0m\n", ok ? 92 : 91, ok ? "OK" : "FAILED");
+  unbox_context_destroy(context);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -1,3 +1,6 @@
+#ifndef MAP_FILE_C
+#define MAP_FILE_C
+
 #include "types.h"
 
 static Slice mapFile(const char *const restrict path);
@@ -54,3 +57,20 @@ static Slice mapFile(const char *const restrict path) {
 }
 static void unmapFile(Slice file) { munmap(file.data, file.size); }
 #endif
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Modification time in nanoseconds, only whole seconds on Windows
+static inline int64_t fileMtimeNs(const struct stat *const s) {
+#if defined(__APPLE__)
+  return (int64_t)s->st_mtimespec.tv_sec * 1000000000 +
+         s->st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  return (int64_t)s->st_mtime * 1000000000;
+#else
+  return (int64_t)s->st_mtim.tv_sec * 1000000000 + s->st_mtim.tv_nsec;
+#endif
+}
+
+#endif
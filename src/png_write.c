@@ -0,0 +1,340 @@
+#ifndef PNG_WRITE_C
+#define PNG_WRITE_C
+
+#include "types.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../dep/stb/stb_image_write.h"
+
+// Grayscale PNG writer for frames. Unlike stbi_write_png it can store 1 and
+// 2-bit frames at their native bit depth, straight from the packed pixels of a
+// .raw reel, instead of expanding them to 8 bits per pixel first, and it can
+// trade compression for speed.
+
+typedef enum {
+  PngDefault, // stb's deflate, best compression
+  PngFast,    // fixed filter, greedy single probe LZ77 with fixed Huffman codes
+  PngStore,   // no filter, stored deflate blocks
+} PngProfile;
+
+static bool png_parse_profile(const char *const restrict s,
+                              PngProfile *const profile) {
+  if (strcmp(s, "default") == 0)
+    *profile = PngDefault;
+  else if (strcmp(s, "fast") == 0)
+    *profile = PngFast;
+  else if (strcmp(s, "store") == 0)
+    *profile = PngStore;
+  else
+    return false;
+  return true;
+}
+
+static uint32_t png_crc32(uint32_t crc, const uint8_t *p, size_t size) {
+  static const uint32_t t[16] = {
+      0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+      0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+      0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+  };
+  crc = ~crc;
+  for (; size; size--, p++) {
+    crc ^= *p;
+    crc = (crc >> 4) ^ t[crc & 15];
+    crc = (crc >> 4) ^ t[crc & 15];
+  }
+  return ~crc;
+}
+
+static inline void png_put_u32(uint8_t *p, const uint32_t x) {
+  p[0] = (uint8_t)(x >> 24);
+  p[1] = (uint8_t)(x >> 16);
+  p[2] = (uint8_t)(x >> 8);
+  p[3] = (uint8_t)x;
+}
+
+static uint32_t png_adler32(const uint8_t *p, size_t size) {
+  uint32_t a = 1;
+  uint32_t b = 0;
+  while (size) {
+    // Largest run that cannot overflow b before the modulo
+    size_t n = min(size, (size_t)5552);
+    size -= n;
+    for (; n; n--, p++) {
+      a += *p;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return b << 16 | a;
+}
+
+// zlib stream of stored blocks, no compression at all
+static unsigned char *png_deflate_store(const uint8_t *const restrict data,
+                                        const size_t size, size_t *out_size) {
+  const size_t blocks = max((size + 65534) / 65535, (size_t)1);
+  uint8_t *const out = STBIW_MALLOC(2 + blocks * 5 + size + 4);
+  if (!out)
+    return NULL;
+  uint8_t *o = out;
+  *o++ = 0x78; // deflate, 32K window
+  *o++ = 0x01; // fastest, no dictionary
+  size_t i = 0;
+  do {
+    const size_t n = min(size - i, (size_t)65535);
+    *o++ = (uint8_t)(i + n == size); // BFINAL, BTYPE 00
+    *o++ = (uint8_t)n;
+    *o++ = (uint8_t)(n >> 8);
+    *o++ = (uint8_t)~n;
+    *o++ = (uint8_t)(~n >> 8);
+    memcpy(o, data + i, n);
+    o += n;
+    i += n;
+  } while (i < size);
+  png_put_u32(o, png_adler32(data, size));
+  *out_size = (size_t)(o + 4 - out);
+  return out;
+}
+
+typedef struct {
+  uint8_t *out;
+  uint64_t bits;
+  unsigned count;
+} PngBits;
+
+static inline void png_put_bits(PngBits *b, const uint32_t value,
+                                const unsigned count) {
+  b->bits |= (uint64_t)value << b->count;
+  b->count += count;
+  while (b->count >= 8) {
+    *b->out++ = (uint8_t)b->bits;
+    b->bits >>= 8;
+    b->count -= 8;
+  }
+}
+
+static inline uint32_t png_reverse_bits(uint32_t code, unsigned count) {
+  uint32_t r = 0;
+  for (; count; count--, code >>= 1)
+    r = r << 1 | (code & 1);
+  return r;
+}
+
+// zlib stream of a single fixed Huffman block. Matches are found greedily
+// through a hash table that keeps only the last position of every 4 byte
+// sequence, like the fastest levels of zlib. Scanned frames are mostly runs
+// and repeated rows, which this still catches.
+static unsigned char *png_deflate_fast(const uint8_t *const restrict data,
+                                       const size_t size, size_t *out_size) {
+  static const uint16_t length_base[29] = {
+      3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+      31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+  static const uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                           1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                           4, 4, 4, 4, 5, 5, 5, 5, 0};
+  static const uint16_t distance_base[30] = {
+      1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+      33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+      1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+  static const uint8_t distance_extra[30] = {0, 0, 0,  0,  1,  1,  2,  2,
+                                             3, 3, 4,  4,  5,  5,  6,  6,
+                                             7, 7, 8,  8,  9,  9,  10, 10,
+                                             11, 11, 12, 12, 13, 13};
+  enum { HashBits = 15, Window = 32768, MinMatch = 4, MaxMatch = 258 };
+
+  // Literals take at most 9 bits
+  uint8_t *const out = STBIW_MALLOC(2 + size + size / 8 + 16);
+  int32_t *const head = malloc(sizeof *head << HashBits);
+  if (!out || !head) {
+    STBIW_FREE(out);
+    free(head);
+    return NULL;
+  }
+  for (size_t i = 0; i < (size_t)1 << HashBits; i++)
+    head[i] = -1;
+
+  // Fixed Huffman codes, bit reversed as deflate sends them LSB first
+  uint16_t code[288];
+  uint8_t code_length[288];
+  for (unsigned s = 0; s < 288; s++) {
+    const unsigned length = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+    const unsigned c = s < 144   ? 0x30 + s
+                       : s < 256 ? 0x190 + s - 144
+                       : s < 280 ? s - 256
+                                 : 0xc0 + s - 280;
+    code[s] = (uint16_t)png_reverse_bits(c, length);
+    code_length[s] = (uint8_t)length;
+  }
+
+  PngBits b = {.out = out, .bits = 0, .count = 0};
+  *b.out++ = 0x78;
+  *b.out++ = 0x01;
+  png_put_bits(&b, 1 | 1 << 1, 3); // BFINAL, BTYPE 01
+  size_t i = 0;
+  while (i < size) {
+    size_t length = 0;
+    size_t distance = 0;
+    if (i + MinMatch <= size) {
+      uint32_t x;
+      memcpy(&x, data + i, 4);
+      const uint32_t h = (x * 2654435761u) >> (32 - HashBits);
+      const int64_t candidate = head[h];
+      head[h] = (int32_t)i;
+      if (candidate >= 0 && (int64_t)i - candidate <= Window &&
+          memcmp(data + candidate, data + i, MinMatch) == 0) {
+        const size_t limit = min(size - i, (size_t)MaxMatch);
+        length = MinMatch;
+        while (length < limit && data[candidate + length] == data[i + length])
+          length++;
+        distance = i - (size_t)candidate;
+      }
+    }
+    if (!length) {
+      png_put_bits(&b, code[data[i]], code_length[data[i]]);
+      i++;
+      continue;
+    }
+    unsigned l = 28;
+    while (length_base[l] > length)
+      l--;
+    png_put_bits(&b, code[257 + l], code_length[257 + l]);
+    png_put_bits(&b, (uint32_t)(length - length_base[l]), length_extra[l]);
+    unsigned d = 29;
+    while (distance_base[d] > distance)
+      d--;
+    png_put_bits(&b, png_reverse_bits(d, 5), 5);
+    png_put_bits(&b, (uint32_t)(distance - distance_base[d]),
+                 distance_extra[d]);
+    i += length;
+  }
+  png_put_bits(&b, code[256], code_length[256]);
+  png_put_bits(&b, 0, 7); // pad to a byte boundary
+  free(head);
+  // Noise-like frames (dithered 1-bit content) expand by up to 9/8
+  if ((size_t)(b.out - out) > size + size / 65535 * 5 + 5) {
+    STBIW_FREE(out);
+    return png_deflate_store(data, size, out_size);
+  }
+  png_put_u32(b.out, png_adler32(data, size));
+  *out_size = (size_t)(b.out + 4 - out);
+  return out;
+}
+
+static bool png_write_chunk(FILE *f, const char *const restrict type,
+                            const uint8_t *data, const uint32_t size) {
+  uint8_t head[8];
+  png_put_u32(head, size);
+  memcpy(head + 4, type, 4);
+  uint8_t tail[4];
+  png_put_u32(tail, png_crc32(png_crc32(0, head + 4, 4), data, size));
+  return fwrite(head, sizeof head, 1, f) == 1 &&
+         (!size || fwrite(data, size, 1, f) == 1) &&
+         fwrite(tail, sizeof tail, 1, f) == 1;
+}
+
+// Whether a frame can be written with its native bit depth, rows have to
+// start on a byte boundary in both the .raw and the PNG layout
+static inline bool png_native_depth_supported(const uint32_t width,
+                                              const uint8_t color_depth) {
+  return (color_depth == 1 || color_depth == 2 || color_depth == 8) &&
+         (uint64_t)width * color_depth % 8 == 0;
+}
+
+// Writes a grayscale PNG with a bit depth of `color_depth`. `data` holds 8-bit
+// pixels or, for 1 and 2-bit frames, pixels packed LSB first like in a .raw
+// reel. PNG packs them MSB first, so they are reordered within each byte.
+// `scanlines` is scratch space that is grown as needed.
+static bool png_write_gray(const char *const restrict path,
+                           const uint8_t *const restrict data,
+                           const uint32_t width, const uint32_t height,
+                           const uint8_t color_depth, const PngProfile profile,
+                           Slice *const scanlines) {
+  if (!width || !height || !png_native_depth_supported(width, color_depth))
+    return false;
+  const size_t stride = (size_t)width * color_depth / 8;
+  const size_t size = (stride + 1) * height;
+  if (size > INT32_MAX)
+    return false;
+  if (scanlines->size < size) {
+    void *const p = realloc(scanlines->data, size);
+    if (!p)
+      return false;
+    scanlines->data = p;
+    scanlines->size = size;
+  }
+
+  uint8_t reorder[256];
+  for (unsigned b = 0; b < 256; b++) {
+    unsigned r = 0;
+    for (unsigned i = 0; i < 8; i += color_depth)
+      r |= ((b >> i) & ((1u << color_depth) - 1)) << (8 - color_depth - i);
+    reorder[b] = (uint8_t)r;
+  }
+  // Low bit depths gain nothing from filtering and get None on every row.
+  // 8-bit frames get Up when speed matters, instead of trying every filter on
+  // every row.
+  const bool up = color_depth == 8 && profile == PngFast;
+  uint8_t *out = (uint8_t *)scanlines->data;
+  for (uint32_t y = 0; y < height; y++) {
+    const uint8_t *const row = data + y * stride;
+    *out++ = up && y ? 2 : 0;
+    if (up && y) {
+      for (size_t x = 0; x < stride; x++)
+        out[x] = (uint8_t)(row[x] - row[x - stride]);
+    } else if (color_depth == 8) {
+      memcpy(out, row, stride);
+    } else {
+      for (size_t x = 0; x < stride; x++)
+        out[x] = reorder[row[x]];
+    }
+    out += stride;
+  }
+
+  size_t compressed_size = 0;
+  unsigned char *compressed = NULL;
+  if (profile == PngStore) {
+    compressed = png_deflate_store(scanlines->data, size, &compressed_size);
+  } else if (profile == PngFast) {
+    compressed = png_deflate_fast(scanlines->data, size, &compressed_size);
+  } else {
+    int n;
+    compressed =
+        stbi_zlib_compress((unsigned char *)scanlines->data, (int)size, &n,
+                           stbi_write_png_compression_level);
+    compressed_size = (size_t)n;
+  }
+  if (!compressed || compressed_size > UINT32_MAX) {
+    STBIW_FREE(compressed);
+    return false;
+  }
+
+  uint8_t ihdr[13];
+  png_put_u32(ihdr, width);
+  png_put_u32(ihdr + 4, height);
+  ihdr[8] = color_depth;
+  ihdr[9] = 0;  // grayscale
+  ihdr[10] = 0; // deflate
+  ihdr[11] = 0; // adaptive filtering
+  ihdr[12] = 0; // not interlaced
+
+  FILE *f = fopen(path, "wb");
+  bool ok = f != NULL;
+  if (f) {
+    ok = fwrite("\x89PNG\r\n\x1a\n", 8, 1, f) == 1 &&
+         png_write_chunk(f, "IHDR", ihdr, sizeof ihdr) &&
+         png_write_chunk(f, "IDAT", compressed, (uint32_t)compressed_size) &&
+         png_write_chunk(f, "IEND", NULL, 0);
+    ok = fclose(f) == 0 && ok;
+    if (!ok)
+      remove(path);
+  }
+  STBIW_FREE(compressed);
+  return ok;
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef RAW_FILE_C
+#define RAW_FILE_C
+
+#include "types.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  uint64_t frame_id;
+  uint32_t frame_height;
+  uint32_t frame_width;
+  uint8_t color_depth;
+  uint8_t version;
+  uint8_t colors_per_channel;
+  uint8_t reserved_[13];
+} RawFileHeader;
+
+static inline void printHeader(const RawFileHeader *const h) {
+  char buf[256];
+  int len = snprintf(buf, sizeof buf,
+                     "Header#%05" PRIu64 " v%" PRIu8 " %" PRIu32 "x%" PRIu32
+                     " %" PRIu8 "bpp %" PRIu8 "cpc",
+                     h->frame_id, h->version, h->frame_width, h->frame_height,
+                     h->color_depth, h->colors_per_channel);
+  fwrite(buf, 1, (size_t)len, stdout);
+}
+
+typedef struct {
+  uint8_t reserved_[24];
+  uint8_t crc[8];
+} RawFileFooter;
+
+static inline int writeCRC64(const unsigned char *restrict const crc,
+                             char *restrict const out) {
+  return snprintf(out, 17,
+                  "%02" PRIx8 "%02" PRIx8 "%02" PRIx8 "%02" PRIx8 "%02" PRIx8
+                  "%02" PRIx8 "%02" PRIx8 "%02" PRIx8,
+                  crc[0], crc[1], crc[2], crc[3], crc[4], crc[5], crc[6],
+                  crc[7]);
+}
+
+// Size of a whole frame record (header, packed pixels, footer), 0 if the
+// color depth is not supported
+static inline size_t raw_record_size(const uint32_t width,
+                                     const uint32_t height,
+                                     const uint8_t color_depth) {
+  const size_t pixels = (size_t)width * height;
+  size_t data_size;
+  if (color_depth == 1)
+    data_size = pixels / 8;
+  else if (color_depth == 2)
+    data_size = pixels / 4;
+  else if (color_depth == 8)
+    data_size = pixels;
+  else
+    return 0;
+  return sizeof(RawFileHeader) + data_size + sizeof(RawFileFooter);
+}
+
+static inline size_t raw_frame_record_size(const RawFileHeader *const h) {
+  return raw_record_size(h->frame_width, h->frame_height, h->color_depth);
+}
+
+// The CRC64 in the footer is stored big endian
+static inline uint64_t raw_footer_crc(const RawFileFooter *const f) {
+  uint64_t crc = 0;
+  for (unsigned i = 0; i < 8; i++)
+    crc = (crc << 8) | f->crc[i];
+  return crc;
+}
+
+static inline void raw_set_footer_crc(RawFileFooter *const f,
+                                      const uint64_t crc) {
+  for (unsigned i = 0; i < 8; i++)
+    f->crc[i] = (uint8_t)(crc >> (56 - i * 8));
+}
+
+static inline void printFooter(const RawFileFooter *const f) {
+  char buf[256];
+  int len = snprintf(buf, sizeof buf, "Footer ");
+  len += writeCRC64(f->crc, buf + len);
+  fwrite(buf, 1, (size_t)len, stdout);
+}
+
+static inline bool splat_pixels(const uint8_t *const restrict data,
+                                const uint32_t width, const uint32_t height,
+                                const uint8_t color_depth,
+                                Slice *const output_image) {
+  const size_t frame_size = width * height;
+  if (output_image->size < frame_size) {
+    void *const new_output_image = realloc(output_image->data, frame_size);
+    if (!new_output_image)
+      return false;
+    output_image->data = new_output_image;
+    output_image->size = frame_size;
+  }
+
+  uint8_t *const out_data = (uint8_t *)output_image->data;
+  if (color_depth == 8)
+    memcpy(out_data, data, frame_size);
+  else if (color_depth == 2) {
+    for (unsigned i = 0; i < frame_size >> 2; i++) {
+      uint32_t x = data[i];
+      x |= x << 6;
+      x |= x << 12;
+      x &= 0x03030303;
+      x *= 85;
+      ((uint32_t *)out_data)[i] = x;
+    }
+  } else if (color_depth == 1) {
+    for (unsigned i = 0; i < frame_size >> 3; i++) {
+      out_data[i * 8 + 0] = ((data[i] & (1 << 0)) >> 0) * 255;
+      out_data[i * 8 + 1] = ((data[i] & (1 << 1)) >> 1) * 255;
+      out_data[i * 8 + 2] = ((data[i] & (1 << 2)) >> 2) * 255;
+      out_data[i * 8 + 3] = ((data[i] & (1 << 3)) >> 3) * 255;
+      out_data[i * 8 + 4] = ((data[i] & (1 << 4)) >> 4) * 255;
+      out_data[i * 8 + 5] = ((data[i] & (1 << 5)) >> 5) * 255;
+      out_data[i * 8 + 6] = ((data[i] & (1 << 6)) >> 6) * 255;
+      out_data[i * 8 + 7] = ((data[i] & (1 << 7)) >> 7) * 255;
+    }
+  } else
+    return false;
+  return true;
+}
+
+// Inverse of splat_pixels: quantizes 8-bit pixels to the nearest of the
+// 2^color_depth levels and packs them LSB first. `output` must hold
+// width * height * color_depth / 8 bytes.
+static inline bool pack_pixels(const uint8_t *const restrict data,
+                               const uint32_t width, const uint32_t height,
+                               const uint8_t color_depth,
+                               uint8_t *const restrict output) {
+  const size_t frame_size = (size_t)width * height;
+  if (color_depth == 8)
+    memcpy(output, data, frame_size);
+  else if (color_depth == 2) {
+    for (size_t i = 0; i < frame_size >> 2; i++) {
+      uint8_t x = 0;
+      for (unsigned j = 0; j < 4; j++)
+        x |= (uint8_t)(((data[i * 4 + j] + 42) / 85) << (j * 2));
+      output[i] = x;
+    }
+  } else if (color_depth == 1) {
+    for (size_t i = 0; i < frame_size >> 3; i++) {
+      uint8_t x = 0;
+      for (unsigned j = 0; j < 8; j++)
+        x |= (uint8_t)((data[i * 8 + j] >> 7) << j);
+      output[i] = x;
+    }
+  } else
+    return false;
+  return true;
+}
+
+// Smallest depth that holds the frame exactly: 1-bit if it only has black and
+// white, 2-bit if it only has the 4 levels splat_pixels expands to. Other
+// frames, like continuous-tone scans, would lose information packed below 8.
+static inline uint8_t detectColorDepth(const uint8_t *const restrict pixels,
+                                       const size_t count) {
+  bool seen[256] = {false};
+  for (size_t i = 0; i < count; i++)
+    seen[pixels[i]] = true;
+  bool two_levels = true;
+  bool four_levels = true;
+  for (unsigned v = 0; v < 256; v++) {
+    if (!seen[v])
+      continue;
+    two_levels = two_levels && (v == 0 || v == 255);
+    four_levels = four_levels && v % 85 == 0;
+  }
+  return two_levels ? 1 : four_levels ? 2 : 8;
+}
+
+#endif
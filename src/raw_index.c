@@ -0,0 +1,211 @@
+#ifndef RAW_INDEX_C
+#define RAW_INDEX_C
+
+#include "grow.c"
+#include "map_file.c"
+#include "raw_file.c"
+#include "types.h"
+#include "unboxing_log.c"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Sidecar seek index of a .raw reel, stored next to it as "<reel>.idx": a
+// header followed by one entry per frame in file order. It is built by
+// walking the reel once and is only trusted while the size, modification
+// time (in nanoseconds where the platform has them) and inode of the reel
+// match the ones recorded in it, and all of its frames lie within the reel.
+
+#define RAW_INDEX_VERSION 2
+
+typedef struct {
+  char magic[8]; // "UNBOXIDX"
+  uint32_t version;
+  uint32_t count;
+  uint64_t reel_size;
+  int64_t reel_mtime_ns;
+  uint64_t reel_inode;
+  uint32_t sorted; // frame ids are increasing, lookups can bisect
+  uint8_t reserved_[20];
+} RawIndexHeader;
+
+typedef struct {
+  uint64_t frame_id;
+  uint64_t offset; // of the RawFileHeader
+  uint32_t width;
+  uint32_t height;
+  uint8_t color_depth;
+  uint8_t reserved_[7];
+} RawIndexEntry;
+
+typedef struct {
+  Slice map; // mapped index file, or empty if `entries` is owned
+  const RawIndexHeader *header;
+  const RawIndexEntry *entries;
+  uint32_t count;
+  bool sorted;
+} RawIndex;
+
+static bool RawIndex_validate(const RawIndex *index, const Slice map,
+                              const struct stat *reel_stat, const Slice reel) {
+  if (map.size < sizeof(RawIndexHeader))
+    return false;
+  const RawIndexHeader *h = (const RawIndexHeader *)map.data;
+  if (memcmp(h->magic, "UNBOXIDX", 8) != 0 ||
+      h->version != RAW_INDEX_VERSION ||
+      h->reel_size != (uint64_t)reel_stat->st_size ||
+      h->reel_mtime_ns != fileMtimeNs(reel_stat) ||
+      h->reel_inode != (uint64_t)reel_stat->st_ino ||
+      map.size != sizeof *h + (size_t)h->count * sizeof *index->entries)
+    return false;
+  const RawIndexEntry *const entries = (const RawIndexEntry *)(h + 1);
+  for (uint32_t i = 0; i < h->count; i++) {
+    const RawIndexEntry *const e = &entries[i];
+    const size_t size = raw_record_size(e->width, e->height, e->color_depth);
+    if (!size || e->offset > reel.size || size > reel.size - e->offset)
+      return false;
+  }
+  return true;
+}
+
+// Walks all frame headers of the reel up to the first malformed or truncated
+// record, returns the number of entries or -1 if out of memory
+static int64_t RawIndex_scan(const Slice reel, RawIndexEntry **out,
+                             bool *sorted) {
+  const uint8_t *const ptr = (const uint8_t *)reel.data;
+  size_t cap = 0;
+  int64_t count = 0;
+  *out = NULL;
+  *sorted = true;
+  size_t i = 0;
+  while (i + sizeof(RawFileHeader) <= reel.size) {
+    const RawFileHeader *const header = (const RawFileHeader *)(ptr + i);
+    const size_t record_size = raw_frame_record_size(header);
+    if (!record_size || record_size > reel.size - i)
+      break;
+    if (!grow((void **)out, sizeof **out, &cap, (size_t)count + 1)) {
+      free(*out);
+      *out = NULL;
+      return -1;
+    }
+    if (count && header->frame_id <= (*out)[count - 1].frame_id)
+      *sorted = false;
+    RawIndexEntry *entry = &(*out)[count++];
+    memset(entry, 0, sizeof *entry);
+    entry->frame_id = header->frame_id;
+    entry->offset = i;
+    entry->width = header->frame_width;
+    entry->height = header->frame_height;
+    entry->color_depth = header->color_depth;
+    i += record_size;
+  }
+  return count;
+}
+
+// Writes the index next to the reel through a temporary file, so a reader
+// never maps a half written index
+static bool RawIndex_write(const char *const restrict index_path,
+                           const RawIndexHeader *header,
+                           const RawIndexEntry *entries) {
+  char tmp_path[4096];
+  int r = snprintf(tmp_path, sizeof tmp_path, "%s.tmp", index_path);
+  if (r < 0 || r >= (int)sizeof tmp_path)
+    return false;
+  FILE *f = fopen(tmp_path, "wb");
+  if (!f)
+    return false;
+  bool ok = fwrite(header, sizeof *header, 1, f) == 1 &&
+            fwrite(entries, sizeof *entries, header->count, f) == header->count;
+  ok = fclose(f) == 0 && ok;
+  remove(index_path);
+  if (!ok || rename(tmp_path, index_path) != 0) {
+    remove(tmp_path);
+    return false;
+  }
+  return true;
+}
+
+// Opens the index of the .raw reel at `reel_path`, which is mapped as `reel`.
+// A missing or stale index is rebuilt from the reel and written out for the
+// next open. Writing it may fail (read-only media), the index still works.
+static bool RawIndex_open(RawIndex *index, const char *const restrict reel_path,
+                          const Slice reel) {
+  *index = (RawIndex){.map = Slice_empty, .header = NULL, .entries = NULL};
+  struct stat reel_stat;
+  if (stat(reel_path, &reel_stat) != 0)
+    return false;
+  char index_path[4096];
+  int r = snprintf(index_path, sizeof index_path, "%s.idx", reel_path);
+  if (r < 0 || r >= (int)sizeof index_path)
+    return false;
+
+  Slice map = mapFile(index_path);
+  if (map.data && RawIndex_validate(index, map, &reel_stat, reel)) {
+    index->map = map;
+    index->header = (const RawIndexHeader *)map.data;
+    index->entries = (const RawIndexEntry *)(index->header + 1);
+    index->count = index->header->count;
+    index->sorted = index->header->sorted != 0;
+    return true;
+  }
+  if (map.data)
+    unmapFile(map);
+
+  RawIndexEntry *entries;
+  bool sorted;
+  const int64_t count = RawIndex_scan(reel, &entries, &sorted);
+  if (count < 0 || count > UINT32_MAX)
+    return false;
+  RawIndexHeader header;
+  memset(&header, 0, sizeof header);
+  memcpy(header.magic, "UNBOXIDX", 8);
+  header.version = RAW_INDEX_VERSION;
+  header.count = (uint32_t)count;
+  header.reel_size = (uint64_t)reel_stat.st_size;
+  header.reel_mtime_ns = fileMtimeNs(&reel_stat);
+  header.reel_inode = (uint64_t)reel_stat.st_ino;
+  header.sorted = sorted;
+  if (count && !RawIndex_write(index_path, &header, entries))
+    boxing_log_args(BoxingLogLevelWarning, "%s: failed to write index",
+                    index_path);
+  index->entries = entries;
+  index->count = (uint32_t)count;
+  index->sorted = sorted;
+  return true;
+}
+
+static void RawIndex_close(RawIndex *index) {
+  if (index->map.data)
+    unmapFile(index->map);
+  else
+    free((void *)index->entries);
+  *index = (RawIndex){.map = Slice_empty, .header = NULL, .entries = NULL};
+}
+
+// Entry of the frame with the given id, or NULL
+static inline const RawIndexEntry *RawIndex_find(const RawIndex *index,
+                                                 const uint64_t frame_id) {
+  if (!index->sorted) {
+    for (uint32_t i = 0; i < index->count; i++)
+      if (index->entries[i].frame_id == frame_id)
+        return &index->entries[i];
+    return NULL;
+  }
+  uint32_t lo = 0;
+  uint32_t hi = index->count;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    if (index->entries[mid].frame_id < frame_id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < index->count && index->entries[lo].frame_id == frame_id
+             ? &index->entries[lo]
+             : NULL;
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef RAW_STREAM_C
+#define RAW_STREAM_C
+
+#include "crc64.c"
+#include "raw_file.c"
+#include "stats.c"
+#include "types.h"
+#include "unboxing_log.c"
+#include <boxing/math/crc64.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// Reads a .raw reel as a stream of frame records (from stdin or a pipe, as a
+// capture rig writes them) instead of mapping it. Records are read only as
+// far as the frame asked for, checked against their footer CRC and kept
+// while they may still be asked for: every frame before `RawStream_expect`
+// is first called (the control frame and TOC come first), after that only
+// frames with pending expectations. Keeping more than `limit` bytes fails.
+
+#define RAW_STREAM_FRAMES 65536
+
+typedef struct {
+  FILE *file;
+  const char *name;
+  Crc64 crc64;
+  dcrc64 *fallback; // when the fast CRC64 does not match the library's
+  Slice *records;   // buffered record of each frame id, or empty
+  uint16_t *pending;
+  bool planned;
+  bool swept;
+  size_t buffered; // bytes held in `records`
+  size_t limit;
+  uint32_t received;
+  uint64_t last_id; // of the last record read
+} RawStream;
+
+static void RawStream_drop(RawStream *s, const uint32_t id) {
+  s->buffered -= s->records[id].size;
+  free(s->records[id].data);
+  s->records[id] = Slice_empty;
+}
+
+// "-" is stdin, anything else a pipe (or file) to read from start to end
+static bool RawStream_open(RawStream *s, const char *const restrict path,
+                           const size_t limit) {
+  memset(s, 0, sizeof *s);
+  s->name = strcmp(path, "-") == 0 ? "stdin" : path;
+  s->limit = limit;
+  s->records = calloc(RAW_STREAM_FRAMES, sizeof *s->records);
+  s->pending = calloc(RAW_STREAM_FRAMES, sizeof *s->pending);
+  if (!s->records || !s->pending)
+    return false;
+  if (!crc64_init(&s->crc64) &&
+      !(s->fallback = boxing_math_crc64_create_def()))
+    return false;
+  if (strcmp(path, "-") == 0) {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    s->file = stdin;
+  } else {
+    s->file = fopen(path, "rb");
+  }
+  return s->file != NULL;
+}
+
+static void RawStream_close(RawStream *s) {
+  if (s->file && s->file != stdin)
+    fclose(s->file);
+  if (s->fallback)
+    boxing_math_crc64_free(s->fallback);
+  for (uint32_t id = 0; s->records && id < RAW_STREAM_FRAMES; id++)
+    free(s->records[id].data);
+  free(s->records);
+  free(s->pending);
+}
+
+// Frames `first` to `last` will be asked for once more
+static void RawStream_expect(RawStream *s, const int first, const int last) {
+  s->planned = true;
+  for (int f = max(first, 0); f <= last && f < RAW_STREAM_FRAMES; f++)
+    if (s->pending[f] < UINT16_MAX)
+      s->pending[f]++;
+}
+
+// Reads the next record into the buffer if it is wanted. Returns false at the
+// end of the stream or on a read error, a malformed record or a full buffer.
+static bool RawStream_read(RawStream *s) {
+  RawFileHeader header;
+  if (fread(&header, sizeof header, 1, s->file) != 1) {
+    if (ferror(s->file))
+      boxing_log_args(BoxingLogLevelError, "%s: read failed", s->name);
+    return false;
+  }
+  const size_t size = raw_frame_record_size(&header);
+  if (!size) {
+    boxing_log_args(BoxingLogLevelError,
+                    "%s: malformed header after %" PRIu32 " frames", s->name,
+                    s->received);
+    return false;
+  }
+  const uint64_t t0 = stats_clock();
+  Slice record = {.data = malloc(size), .size = size};
+  if (!record.data)
+    return false;
+  memcpy(record.data, &header, sizeof header);
+  const bool complete = fread((uint8_t *)record.data + sizeof header,
+                              size - sizeof header, 1, s->file) == 1;
+  stats_record(StageMap, t0);
+  if (!complete) {
+    boxing_log_args(BoxingLogLevelError, "%s: frame %" PRIu64 " is truncated",
+                    s->name, header.frame_id);
+    free(record.data);
+    return false;
+  }
+  s->received++;
+  s->last_id = header.frame_id;
+
+  const RawFileFooter *const footer =
+      (const RawFileFooter *)((uint8_t *)record.data + size) - 1;
+  const uint64_t crc = crc64_calc(&s->crc64, s->fallback, record.data,
+                                  size - sizeof footer->crc);
+  const uint64_t id = header.frame_id;
+  if (crc != raw_footer_crc(footer)) {
+    // Skipped rather than fatal, only files that need it fail
+    boxing_log_args(BoxingLogLevelError, "%s: frame %" PRIu64 " CRC mismatch",
+                    s->name, id);
+    free(record.data);
+    return true;
+  }
+  if (id >= RAW_STREAM_FRAMES || (s->planned && !s->pending[id])) {
+    free(record.data);
+    return true;
+  }
+  if (s->records[id].data)
+    RawStream_drop(s, (uint32_t)id);
+  if (s->buffered + size > s->limit) {
+    boxing_log_args(BoxingLogLevelError,
+                    "%s: frame %" PRIu64 " does not fit in the %zu MiB stream "
+                    "buffer",
+                    s->name, id, s->limit >> 20);
+    free(record.data);
+    return false;
+  }
+  s->records[id] = record;
+  s->buffered += size;
+  return true;
+}
+
+// The record of frame `f`, reading up to it if it has not arrived yet. Empty
+// if the stream ends without it.
+static Slice RawStream_get(RawStream *s, const int f) {
+  if (f < 0 || f >= RAW_STREAM_FRAMES)
+    return Slice_empty;
+  // Frames buffered before the plan that no file needs
+  if (s->planned && !s->swept) {
+    for (uint32_t id = 0; id < RAW_STREAM_FRAMES; id++)
+      if (s->records[id].data && !s->pending[id])
+        RawStream_drop(s, id);
+    s->swept = true;
+  }
+  while (!s->records[f].data)
+    if (!RawStream_read(s) || s->last_id == (uint64_t)f)
+      break;
+  return s->records[f];
+}
+
+// Called once frame `f` is decoded, drops it after its last expected use
+static void RawStream_release(RawStream *s, const int f) {
+  if (!s->planned || f < 0 || f >= RAW_STREAM_FRAMES)
+    return;
+  if (s->pending[f])
+    s->pending[f]--;
+  if (!s->pending[f] && s->records[f].data)
+    RawStream_drop(s, (uint32_t)f);
+}
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef READ_FILE_C
+#define READ_FILE_C
+
+#include "map_file.c"
+#include "types.h"
+#include "unboxing_log.c"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/vfs.h>
+#elif defined(__APPLE__)
+#include <sys/mount.h>
+#include <sys/param.h>
+#endif
+
+// How frame files are read. Mapping costs a mmap/munmap pair and page faults
+// per file, which several decode threads turn into page-table churn and which
+// are small serialized reads on network filesystems. Reading copies the file
+// into a buffer reused for every file instead, with one large read, and direct
+// reads also bypass the page cache (O_DIRECT, F_NOCACHE on macOS), for reels
+// read once. Auto picks reading on network filesystems and mapping elsewhere.
+// Windows always maps.
+enum FileReadMode {
+  FileReadMmap,
+  FileReadPread,
+  FileReadDirect,
+  FileReadAuto,
+};
+
+static const char *const file_read_mode_name[] = {
+    "mmap",
+    "pread",
+    "direct",
+    "auto",
+};
+
+// Reads the files of one thread at a time, a file read into the buffer is
+// valid until the next one is read
+typedef struct {
+  enum FileReadMode mode; // resolved by the first read when auto
+  void *buffer;
+  size_t buffer_size;
+} FileReader;
+
+#define FILE_READ_ALIGNMENT 4096u
+
+static inline bool file_read_parse_mode(const char *const restrict str,
+                                        enum FileReadMode *out) {
+  for (int i = FileReadMmap; i <= FileReadAuto; i++) {
+    if (strcmp(str, file_read_mode_name[i]) == 0) {
+      *out = (enum FileReadMode)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Filesystems where page faults on a mapping turn into small synchronous
+// network reads
+static enum FileReadMode file_read_probe(const char *const restrict path) {
+#ifdef __linux__
+  struct statfs s;
+  if (statfs(path, &s) != 0)
+    return FileReadMmap;
+  switch ((uint32_t)s.f_type) {
+  case 0x6969u:     // NFS
+  case 0x517bu:     // SMB
+  case 0xfe534d42u: // SMB2
+  case 0xff534d42u: // CIFS
+  case 0x65735546u: // FUSE
+  case 0x00c36400u: // Ceph
+  case 0x01021997u: // 9P
+    return FileReadPread;
+  default:
+    return FileReadMmap;
+  }
+#elif defined(__APPLE__)
+  struct statfs s;
+  if (statfs(path, &s) != 0)
+    return FileReadMmap;
+  return strcmp(s.f_fstypename, "nfs") == 0 ||
+                 strcmp(s.f_fstypename, "smbfs") == 0 ||
+                 strcmp(s.f_fstypename, "afpfs") == 0 ||
+                 strncmp(s.f_fstypename, "osxfuse", 7) == 0 ||
+                 strncmp(s.f_fstypename, "macfuse", 7) == 0
+             ? FileReadPread
+             : FileReadMmap;
+#else
+  (void)path;
+  return FileReadMmap;
+#endif
+}
+
+#ifndef _WIN32
+// Aligned for direct reads, which also read whole blocks past the end of the
+// file
+static bool file_read_reserve(FileReader *r, const size_t size) {
+  const size_t aligned =
+      (size + FILE_READ_ALIGNMENT - 1) / FILE_READ_ALIGNMENT *
+      FILE_READ_ALIGNMENT;
+  if (aligned <= r->buffer_size)
+    return true;
+  // Grow in steps of 1 MiB, frame files of a reel are about the same size
+  const size_t step = (size_t)1 << 20;
+  const size_t new_size = (aligned + step - 1) / step * step;
+  void *buffer;
+  if (posix_memalign(&buffer, FILE_READ_ALIGNMENT, new_size) != 0)
+    return false;
+  free(r->buffer);
+  r->buffer = buffer;
+  r->buffer_size = new_size;
+  return true;
+}
+
+static Slice file_read_fd(FileReader *r, const int fd, const bool direct) {
+  struct stat s;
+  if (fstat(fd, &s) == -1 || s.st_size <= 0 ||
+      !file_read_reserve(r, (size_t)s.st_size))
+    return Slice_empty;
+  const size_t size = (size_t)s.st_size;
+  // Direct reads have to be whole blocks, the last one comes back short
+  const size_t request =
+      direct ? (size + FILE_READ_ALIGNMENT - 1) / FILE_READ_ALIGNMENT *
+                   FILE_READ_ALIGNMENT
+             : size;
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t n = pread(fd, (uint8_t *)r->buffer + done, request - done,
+                            (off_t)done);
+    if (n > 0)
+      done += (size_t)n;
+    else if (n == 0 || errno != EINTR)
+      break;
+  }
+  return done >= size ? (Slice){.data = r->buffer, .size = size}
+                      : Slice_empty;
+}
+
+static Slice file_read_buffered(FileReader *r, const char *const restrict path,
+                                const bool direct) {
+  int fd = -1;
+#ifdef O_DIRECT
+  if (direct)
+    fd = open(path, O_RDONLY | O_DIRECT);
+#endif
+  // Filesystems without direct IO (tmpfs, some FUSE) read through the cache
+  const bool opened_direct = fd != -1;
+  if (fd == -1)
+    fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return Slice_empty;
+#ifdef F_NOCACHE
+  if (direct)
+    fcntl(fd, F_NOCACHE, 1);
+#elif !defined(O_DIRECT)
+  (void)direct;
+#endif
+  Slice file = file_read_fd(r, fd, opened_direct);
+  close(fd);
+  return file;
+}
+#endif
+
+// Reads or maps `path`, release it with file_read_release
+static Slice file_read(FileReader *r, const char *const restrict path) {
+  if (r->mode == FileReadAuto) {
+    r->mode = file_read_probe(path);
+    boxing_log_args(BoxingLogLevelInfo, "Reading frames with %s",
+                    file_read_mode_name[r->mode]);
+  }
+#ifndef _WIN32
+  if (r->mode == FileReadPread || r->mode == FileReadDirect)
+    return file_read_buffered(r, path, r->mode == FileReadDirect);
+#endif
+  return mapFile(path);
+}
+
+static void file_read_release(const FileReader *r, const Slice file) {
+  if (file.data && file.data != r->buffer)
+    unmapFile(file);
+}
+
+static void file_read_free(FileReader *r) {
+  free(r->buffer);
+  r->buffer = NULL;
+  r->buffer_size = 0;
+}
+
+#endif
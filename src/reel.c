@@ -8,6 +8,9 @@
 #include "grow.c"
 #include "iterate_dir.c"
 #include "load_image.c"
+#include "raw_index.c"
+#include "raw_stream.c"
+#include "tar.c"
 #include "types.h"
 #include "unboxer_helpers.c"
 #include <boxing/config.h>
@@ -15,21 +18,139 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <tocdata_c.h>
 
+enum ReelSource { ReelDirectory, ReelRaw, ReelTar, ReelStream };
+
+typedef struct Speculation Speculation;
+
+// A reel is a directory of numbered images, a .raw reel file or a tar archive
+// of numbered images. `frames` holds, plus 1 and with 0 for a missing frame:
+// for a directory the offset of the file name in the string pool, for a .raw
+// reel the position of the frame in the reel's index and for a tar archive
+// the position of the member in `members`. Frames of a stream are not known
+// until they arrive.
 typedef struct {
   const char *directory_path;
   Slice string_pool;
   size_t string_pool_used;
   uint16_t count;
   uint32_t frames[65536];
+  enum ReelSource source;
+  Slice archive; // mapped .raw reel or tar archive
+  RawIndex raw_index;
+  Slice raw_pixels; // frame of a .raw reel unpacked to 8 bits per pixel
+  Slice *members;   // contents of the numbered members of a tar archive
+  size_t members_cap;
+  uint32_t member_count;
+  RawStream *stream;   // .raw records read from stdin or a pipe
+  size_t stream_limit; // bytes of records a stream may hold, set before init
+  ImageArena *arena;   // frame images are decoded into, not owned
+  Speculation *speculation; // frames being decoded ahead, see Reel_speculate
 } Reel;
 
+// Frames `first` to `first + count - 1` decoded in order by a background
+// thread into an arena of its own and copied out, so the caller can go on
+// decoding other frames meanwhile. Loading one of them waits for its decode.
+// The thread stays at most REEL_SPECULATE_WINDOW frames ahead of the frames
+// loaded, so unused guesses hold that many frames at most.
+#define REEL_SPECULATE_WINDOW 4
+
+struct Speculation {
+  Reel *reel;
+  int first;
+  int count;
+  Image *images; // pixels owned, NULL data if the frame failed to decode
+  unsigned char *taken; // pixels of the frame handed out last, the unboxer
+                        // may have written to them
+  int decoded;          // frames done so far
+  int next;             // frames before this one are not needed any more
+  int used;
+  bool cancel;
+  Mutex mutex;
+  Cond done;     // a frame was decoded
+  Cond consumed; // `next` moved on or the speculation was cancelled
+  Thread thread;
+  Trace *trace; // of the thread that started the speculation
+  ImageArena arena;
+};
+
+// Frames are the members of the archive named by a number, in any directory.
+// A member appearing again replaces the earlier one, like when extracting.
+static bool Reel_init_tar(Reel *reel, TarIterator *it) {
+  TarEntry ent;
+  while (tar_next(it, &ent)) {
+    char *name_end = ent.name;
+    long id = strtol(ent.name, &name_end, 10);
+    if (name_end == ent.name || id < 0 ||
+        (unsigned long)id >= countof(reel->frames))
+      continue;
+    if (!grow((void **)&reel->members, sizeof *reel->members,
+              &reel->members_cap, reel->member_count + 1))
+      return false;
+    reel->members[reel->member_count++] = (Slice){
+        .data = (uint8_t *)reel->archive.data + ent.offset,
+        .size = ent.size,
+    };
+    if (!reel->frames[id])
+      reel->count++;
+    reel->frames[id] = reel->member_count;
+  }
+  return reel->count != 0;
+}
+
+static bool Reel_init_raw(Reel *reel, const char *const restrict path) {
+  if (!RawIndex_open(&reel->raw_index, path, reel->archive))
+    return false;
+  for (uint32_t i = 0; i < reel->raw_index.count; i++) {
+    const uint64_t id = reel->raw_index.entries[i].frame_id;
+    if (id < countof(reel->frames) && !reel->frames[id]) {
+      reel->frames[id] = i + 1;
+      reel->count++;
+    }
+  }
+  return reel->count != 0;
+}
+
+static bool Reel_init_stream(Reel *reel, const char *const restrict path) {
+  reel->stream = malloc(sizeof *reel->stream);
+  if (!reel->stream)
+    return false;
+  reel->source = ReelStream;
+  reel->directory_path = path;
+  return RawStream_open(reel->stream, path,
+                        reel->stream_limit ? reel->stream_limit
+                                           : (size_t)1 << 30);
+}
+
 static bool
 Reel_init(Reel *reel,
           const char *const
-              directory_path // path to directory containing scanned photos
+              directory_path // path to directory containing scanned photos,
+                             // to a .raw reel or tar archive, or "-" or a
+                             // pipe to stream a .raw reel from
 ) {
+  struct stat s;
+  if (strcmp(directory_path, "-") == 0)
+    return Reel_init_stream(reel, directory_path);
+#ifdef S_ISFIFO
+  if (stat(directory_path, &s) == 0 && S_ISFIFO(s.st_mode))
+    return Reel_init_stream(reel, directory_path);
+#endif
+  if (stat(directory_path, &s) == 0 && S_ISREG(s.st_mode)) {
+    reel->archive = mapFile(directory_path);
+    if (!reel->archive.data)
+      return false;
+    reel->directory_path = directory_path;
+    TarIterator it;
+    if (tar_start(reel->archive, &it)) {
+      reel->source = ReelTar;
+      return Reel_init_tar(reel, &it);
+    }
+    reel->source = ReelRaw;
+    return Reel_init_raw(reel, directory_path);
+  }
   DirIterator it;
   if (!dir_start(directory_path, &it))
     return false;
@@ -61,19 +182,321 @@ Reel_init(Reel *reel,
   return true;
 }
 
-static Reel *Reel_create(void) {
+static Reel *Reel_create(ImageArena *arena) {
   Reel *reel = malloc(sizeof(Reel));
   if (!reel)
     return NULL;
   memset(reel, 0, sizeof *reel);
+  reel->arena = arena;
   return reel;
 }
 
+static void Reel_speculate_end(Reel *reel);
+
 static void Reel_destroy(Reel *reel) {
+  Reel_speculate_end(reel);
+  if (reel->source == ReelRaw)
+    RawIndex_close(&reel->raw_index);
+  if (reel->archive.data)
+    unmapFile(reel->archive);
+  free(reel->raw_pixels.data);
+  free(reel->members);
+  if (reel->stream) {
+    RawStream_close(reel->stream);
+    free(reel->stream);
+  }
   free(reel->string_pool.data);
   free(reel);
 }
 
+// Unpacks a .raw frame record to 8 bits per pixel into `raw_pixels`
+static Image Reel_unpack_record(Reel *reel, const RawFileHeader *const header,
+                                const int f) {
+  const Image none = {.data = NULL, .width = 0, .height = 0};
+  // Frames are unpacked even at 8 bits, the unboxer may write to the image
+  const uint64_t t0 = stats_clock();
+  bool ok = splat_pixels((const uint8_t *)(header + 1), header->frame_width,
+                         header->frame_height, header->color_depth,
+                         &reel->raw_pixels);
+  stats_record(StageInflate, t0);
+  if (!ok) {
+    boxing_log_args(BoxingLogLevelError, "%s: frame %d is malformed",
+                    reel->directory_path, f);
+    return none;
+  }
+  return (Image){.data = reel->raw_pixels.data,
+                 .width = (int)header->frame_width,
+                 .height = (int)header->frame_height};
+}
+
+// Header of frame `f` of a .raw reel, or NULL if its record does not fit in
+// the reel, which a corrupt index could point past
+static const RawFileHeader *Reel_raw_header(const Reel *reel, const int f) {
+  const RawIndexEntry *const entry =
+      &reel->raw_index.entries[reel->frames[f] - 1];
+  const size_t size = reel->archive.size;
+  if (entry->offset > size || sizeof(RawFileHeader) > size - entry->offset)
+    return NULL;
+  const RawFileHeader *const header =
+      (const RawFileHeader *)((const uint8_t *)reel->archive.data +
+                              entry->offset);
+  const size_t record_size = raw_frame_record_size(header);
+  return record_size && record_size <= size - entry->offset ? header : NULL;
+}
+
+// Loads frame `f` as 8 bits per pixel, decoding images into `arena`. The image
+// is valid until the next frame is loaded.
+static Image Reel_load_frame_into(Reel *reel, ImageArena *arena, const int f) {
+  const Image none = {.data = NULL, .width = 0, .height = 0};
+  if (reel->source == ReelStream) {
+    trace_set_frame(f);
+    const Slice record = RawStream_get(reel->stream, f);
+    if (!record.data) {
+      boxing_log_args(BoxingLogLevelError, "%s: frame %d is missing",
+                      reel->directory_path, f);
+      return none;
+    }
+    const Image image =
+        Reel_unpack_record(reel, (const RawFileHeader *)record.data, f);
+    RawStream_release(reel->stream, f);
+    return image;
+  }
+  if (f < 0 || f >= (int)countof(reel->frames) || !reel->frames[f])
+    return none;
+  trace_set_frame(f);
+  if (reel->source == ReelTar) {
+    char name[64];
+    snprintf(name, sizeof name, "frame %d", f);
+    return decodeImage(arena, reel->members[reel->frames[f] - 1], name);
+  }
+  if (reel->source == ReelRaw) {
+    const RawFileHeader *const header = Reel_raw_header(reel, f);
+    if (!header) {
+      boxing_log_args(BoxingLogLevelError, "%s: frame %d is malformed",
+                      reel->directory_path, f);
+      return none;
+    }
+    return Reel_unpack_record(reel, header, f);
+  }
+  char buf[4096];
+  int r = snprintf(buf, sizeof(buf), "%s/%s", reel->directory_path,
+                   (const char *)reel->string_pool.data + reel->frames[f] - 1);
+  if (r < 0 || r >= (int)sizeof(buf))
+    return none;
+  return loadImage(arena, buf);
+}
+
+static void Reel_speculate_worker(void *arg) {
+  Speculation *s = arg;
+  // A failed guess is not an error, the frame is decoded again if needed and
+  // only then logged
+  BoxingLog quiet = boxing_log_default;
+  quiet.threshold = BoxingLogLevelAlways;
+  boxing_log_set_current(&quiet);
+  trace_set_current(s->trace);
+  for (int i = 0; i < s->count; i++) {
+    mutex_lock(&s->mutex);
+    while (!s->cancel && i >= s->next + REEL_SPECULATE_WINDOW)
+      cond_wait(&s->consumed, &s->mutex);
+    const bool cancel = s->cancel;
+    // Skipped over while waiting
+    const bool skip = i < s->next;
+    if (skip) {
+      s->decoded = i + 1;
+      cond_broadcast(&s->done);
+    }
+    mutex_unlock(&s->mutex);
+    if (cancel)
+      break;
+    if (skip)
+      continue;
+    Image image = Reel_load_frame_into(s->reel, &s->arena, s->first + i);
+    const size_t size = (size_t)image.width * (size_t)image.height;
+    unsigned char *pixels = image.data ? malloc(size) : NULL;
+    if (pixels)
+      memcpy(pixels, image.data, size);
+    image.data = pixels;
+    mutex_lock(&s->mutex);
+    s->images[i] = image;
+    s->decoded = i + 1;
+    cond_broadcast(&s->done);
+    mutex_unlock(&s->mutex);
+  }
+  mutex_lock(&s->mutex);
+  s->decoded = s->count;
+  cond_broadcast(&s->done);
+  mutex_unlock(&s->mutex);
+  image_deinit(&s->arena);
+}
+
+// Starts decoding `count` frames from `first` in the background, for frames
+// that are likely needed next but not known to be yet. Only for folders and
+// tar archives, .raw frames are unpacked faster than a thread is started and
+// streams are read in order.
+static bool Reel_speculate(Reel *reel, const int first, const int count) {
+  if (reel->speculation || count <= 0 ||
+      (reel->source != ReelDirectory && reel->source != ReelTar))
+    return false;
+  Speculation *s = calloc(1, sizeof *s);
+  if (!s)
+    return false;
+  s->reel = reel;
+  s->first = first;
+  s->count = count;
+  s->images = calloc((size_t)count, sizeof *s->images);
+  s->trace = trace_current;
+  s->arena.reader.mode = reel->arena ? reel->arena->reader.mode : FileReadAuto;
+  mutex_init(&s->mutex);
+  cond_init(&s->done);
+  cond_init(&s->consumed);
+  if (!s->images || !thread_start(&s->thread, Reel_speculate_worker, s)) {
+    cond_destroy(&s->consumed);
+    cond_destroy(&s->done);
+    mutex_destroy(&s->mutex);
+    free(s->images);
+    free(s);
+    return false;
+  }
+  reel->speculation = s;
+  return true;
+}
+
+// Stops decoding ahead and frees the frames that were not used
+static void Reel_speculate_end(Reel *reel) {
+  Speculation *s = reel->speculation;
+  if (!s)
+    return;
+  mutex_lock(&s->mutex);
+  s->cancel = true;
+  cond_broadcast(&s->consumed);
+  mutex_unlock(&s->mutex);
+  thread_join(s->thread);
+  boxing_log_args(BoxingLogLevelInfo, "Frames %d to %d decoded ahead, %d used",
+                  s->first, s->first + s->count - 1, s->used);
+  for (int i = 0; i < s->count; i++)
+    free(s->images[i].data);
+  free(s->taken);
+  cond_destroy(&s->consumed);
+  cond_destroy(&s->done);
+  mutex_destroy(&s->mutex);
+  free(s->images);
+  free(s);
+  reel->speculation = NULL;
+}
+
+// Frame `f` if it was decoded ahead, waiting for it if it is being decoded
+static Image Reel_speculated_frame(Reel *reel, const int f) {
+  const Image none = {.data = NULL, .width = 0, .height = 0};
+  Speculation *s = reel->speculation;
+  if (!s || f < s->first || f - s->first >= s->count)
+    return none;
+  const int i = f - s->first;
+  mutex_lock(&s->mutex);
+  // Let the thread go on to this frame, frames skipped over are dropped
+  const int next = s->next;
+  if (next < i) {
+    s->next = i;
+    cond_broadcast(&s->consumed);
+  }
+  while (s->decoded <= i)
+    cond_wait(&s->done, &s->mutex);
+  const Image image = s->images[i];
+  s->images[i].data = NULL;
+  for (int j = next; j < i; j++) {
+    free(s->images[j].data);
+    s->images[j].data = NULL;
+  }
+  if (s->next <= i) {
+    s->next = i + 1;
+    cond_broadcast(&s->consumed);
+  }
+  mutex_unlock(&s->mutex);
+  if (image.data) {
+    free(s->taken);
+    s->taken = image.data;
+    s->used++;
+    trace_set_frame(f);
+  }
+  return image;
+}
+
+static Image Reel_load_frame(Reel *reel, const int f) {
+  const Image image = Reel_speculated_frame(reel, f);
+  if (image.data)
+    return image;
+  return Reel_load_frame_into(reel, reel->arena, f);
+}
+
+static uint64_t fnv1a64(uint64_t hash, const void *const restrict data,
+                        const size_t size) {
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ p[i]) * 0x100000001b3ull;
+  return hash;
+}
+
+static uint64_t fnv1a64_stat(uint64_t hash, const struct stat *const s) {
+  const uint64_t fields[4] = {(uint64_t)s->st_dev, (uint64_t)s->st_ino,
+                              (uint64_t)s->st_size, (uint64_t)fileMtimeNs(s)};
+  return fnv1a64(hash, fields, sizeof fields);
+}
+
+// Identifies frame 1 without decoding it: the path, size, modification time
+// (to the nanosecond) and inode of its file (or of the archive it is in), and
+// for .raw reels its header and footer, whose CRC covers its contents. False
+// if there is no frame 1.
+static bool Reel_fingerprint(Reel *reel, uint64_t *const out) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  const RawFileHeader *header = NULL;
+  if (reel->source == ReelStream) {
+    const Slice record = RawStream_get(reel->stream, 1);
+    if (!record.data)
+      return false;
+    header = (const RawFileHeader *)record.data;
+  } else {
+    if (!reel->frames[1])
+      return false;
+    char path[4096];
+    if (reel->source == ReelDirectory)
+      snprintf(path, sizeof path, "%s/%s", reel->directory_path,
+               (const char *)reel->string_pool.data + reel->frames[1] - 1);
+    else
+      snprintf(path, sizeof path, "%s", reel->directory_path);
+    struct stat s;
+    if (stat(path, &s) != 0)
+      return false;
+    hash = fnv1a64(hash, path, strlen(path));
+    hash = fnv1a64_stat(hash, &s);
+    if (reel->source == ReelTar) {
+      const Slice member = reel->members[reel->frames[1] - 1];
+      const uint64_t offset =
+          (uint64_t)((const uint8_t *)member.data -
+                     (const uint8_t *)reel->archive.data);
+      hash = fnv1a64(hash, &offset, sizeof offset);
+    } else if (reel->source == ReelRaw) {
+      header = Reel_raw_header(reel, 1);
+      if (!header)
+        return false;
+    }
+  }
+  if (header) {
+    const uint8_t *const end =
+        (const uint8_t *)header + raw_frame_record_size(header);
+    const RawFileFooter *const footer = (const RawFileFooter *)end - 1;
+    hash = fnv1a64(hash, header, sizeof *header);
+    hash = fnv1a64(hash, footer, sizeof *footer);
+  }
+  *out = hash;
+  return true;
+}
+
+// A stream keeps frames `first` to `last` until they have been loaded once
+// more, for every call. Other reels can load any frame at any time.
+static void Reel_expect_frames(Reel *reel, const int first, const int last) {
+  if (reel->source == ReelStream)
+    RawStream_expect(reel->stream, first, last);
+}
+
 #if 0
 // Reset a reel object and make it ready for loading new reels
 static void Reel_reset(Reel *reel) {
@@ -83,23 +506,13 @@ static void Reel_reset(Reel *reel) {
 #endif
 
 static Slice Reel_unbox_control_frame(Reel *reel, bool *is_raw) {
-  if (!reel->frames[1])
+  if (reel->source != ReelStream && !reel->frames[1])
     return Slice_empty;
   boxing_config *config =
       boxing_config_create_from_structure(&config_source_v7);
   if (!config)
     return Slice_empty;
-  char buf[4096];
-  {
-    int r =
-        snprintf(buf, sizeof(buf), "%s/%s", reel->directory_path,
-                 (const char *)reel->string_pool.data + reel->frames[1] - 1);
-    if (r < 0 || r > (int)sizeof(buf)) {
-      boxing_config_free(config);
-      return Slice_empty;
-    }
-  }
-  Image img = loadImage(buf);
+  Image img = Reel_load_frame(reel, 1);
   if (!img.data) {
     boxing_config_free(config);
     return Slice_empty;
@@ -110,10 +523,17 @@ static Slice Reel_unbox_control_frame(Reel *reel, bool *is_raw) {
     boxing_config_free(config);
     return Slice_empty;
   }
+  // The control frame contents are handed to the caller, who frees them
+  Slice buffer = Slice_empty;
   Slice result;
-  if (UnboxerUnbox(&unboxer, img.data, img.width, img.height,
-                   BOXING_METADATA_CONTENT_TYPES_CONTROLFRAME,
-                   &result) != UnboxOK) {
+  FrameInfo info;
+  enum UnboxerUnboxStatus status = UnboxerUnbox(
+      &unboxer, img.data, img.width, img.height,
+      BOXING_METADATA_CONTENT_TYPES_CONTROLFRAME, &buffer, &result, &info);
+  FrameInfo_log(&info, status == UnboxOK ? BoxingLogLevelDebug
+                                         : BoxingLogLevelError);
+  if (status != UnboxOK || !result.size) {
+    free(buffer.data);
     UnboxerDestroy(&unboxer);
     boxing_config_free(config);
     return Slice_empty;
@@ -127,27 +547,27 @@ static Slice Reel_unbox_control_frame(Reel *reel, bool *is_raw) {
   return result;
 }
 
-static Slice Reel_unbox_toc(Reel *reel, Unboxer *unboxer, afs_toc_file *toc) {
-  char buf[4096];
+static Slice Reel_unbox_toc(Reel *reel, Unboxer *unboxer, Slice *payload,
+                            afs_toc_file *toc) {
   Slice toc_contents = Slice_empty;
   for (int f = toc->start_frame; f <= toc->end_frame; f++) {
-    if (!reel->frames[f])
+    Image frame = Reel_load_frame(reel, f);
+    if (!frame.data) {
+      free(toc_contents.data);
       return Slice_empty;
-    {
-      int r =
-          snprintf(buf, sizeof(buf), "%s/%s", reel->directory_path,
-                   (const char *)reel->string_pool.data + reel->frames[f] - 1);
-      if (r < 0 || r > (int)sizeof(buf))
-        return Slice_empty;
     }
-    Image frame = loadImage(buf);
-    if (!frame.data)
-      return Slice_empty;
     Slice toc_contents_chunk;
-    if (UnboxerUnbox(unboxer, frame.data, frame.width, frame.height,
-                     BOXING_METADATA_CONTENT_TYPES_TOC,
-                     &toc_contents_chunk) != UnboxOK)
+    FrameInfo info;
+    enum UnboxerUnboxStatus status = UnboxerUnbox(
+        unboxer, frame.data, frame.width, frame.height,
+        BOXING_METADATA_CONTENT_TYPES_TOC, payload, &toc_contents_chunk, &info);
+    FrameInfo_log(&info, status == UnboxOK ? BoxingLogLevelDebug
+                                           : BoxingLogLevelError);
+    if (status != UnboxOK) {
+      free(toc_contents.data);
       return Slice_empty;
+    }
+    uint64_t t0 = stats_clock();
     size_t offset = toc_contents.size;
     if (!grow_exact(&toc_contents.data, 1, &toc_contents.size,
                     toc_contents.size + toc_contents_chunk.size)) {
@@ -157,8 +577,11 @@ static Slice Reel_unbox_toc(Reel *reel, Unboxer *unboxer, afs_toc_file *toc) {
     }
     memcpy((char *)toc_contents.data + offset, toc_contents_chunk.data,
            toc_contents_chunk.size);
-    if (toc_contents_chunk.data)
-      free(toc_contents_chunk.data);
+    stats_record(StageSlice, t0);
+  }
+  if (!toc_contents.size) {
+    free(toc_contents.data);
+    return Slice_empty;
   }
   // Assume TOC ends with \n
   ((char *)toc_contents.data)[--toc_contents.size] = '\0';
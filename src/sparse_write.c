@@ -0,0 +1,93 @@
+#ifndef SPARSE_WRITE_C
+#define SPARSE_WRITE_C
+
+#include "types.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+// Writes a new file front to back, seeking over whole blocks of zeros instead
+// of writing them, which leaves holes where the filesystem supports them (and
+// zeros where it does not). The file is a new one, so nothing has to be
+// punched out of it. sparse_finish sets the size if the file ends in a hole.
+
+#define SPARSE_BLOCK 4096u
+
+typedef struct {
+  FILE *file; // unbuffered
+  uint64_t offset;
+  bool holes; // the file ends before `offset`
+} SparseFile;
+
+// 64 bytes at a time, compilers turn the ORs into vector instructions
+static bool sparse_is_zero(const uint8_t *const restrict p, const size_t size) {
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    uint64_t w[8];
+    memcpy(w, p + i, sizeof w);
+    if ((w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | w[7]) != 0)
+      return false;
+  }
+  for (; i < size; i++)
+    if (p[i])
+      return false;
+  return true;
+}
+
+// Bytes from `i` to the end of its block of the file
+static size_t sparse_block_length(const SparseFile *s, const size_t size,
+                                  const size_t i) {
+  const size_t block = SPARSE_BLOCK - (size_t)((s->offset + i) % SPARSE_BLOCK);
+  return min(block, size - i);
+}
+
+static bool sparse_zero_block(const SparseFile *s,
+                              const uint8_t *const restrict data,
+                              const size_t size, const size_t i) {
+  return sparse_block_length(s, size, i) == SPARSE_BLOCK &&
+         sparse_is_zero(data + i, SPARSE_BLOCK);
+}
+
+static bool sparse_write(SparseFile *s, const uint8_t *const restrict data,
+                         const size_t size) {
+  size_t i = 0;
+  while (i < size) {
+    // Whole blocks of zeros, or everything up to the next one
+    const bool zero = sparse_zero_block(s, data, size, i);
+    size_t end = i;
+    do
+      end += sparse_block_length(s, size, end);
+    while (end < size && sparse_zero_block(s, data, size, end) == zero);
+    if (zero) {
+      if (fseek(s->file, (long)(end - i), SEEK_CUR) != 0)
+        return false;
+    } else if (fwrite(data + i, 1, end - i, s->file) != end - i) {
+      return false;
+    }
+    s->holes = zero;
+    s->offset += end - i;
+    i = end;
+  }
+  return true;
+}
+
+static bool sparse_finish(SparseFile *s) {
+  if (!s->holes)
+    return true;
+  if (fflush(s->file) != 0)
+    return false;
+#ifdef _WIN32
+  return _chsize_s(_fileno(s->file), (long long)s->offset) == 0;
+#else
+  return ftruncate(fileno(s->file), (off_t)s->offset) == 0;
+#endif
+}
+
+#endif
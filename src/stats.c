@@ -0,0 +1,155 @@
+#ifndef STATS_C
+#define STATS_C
+
+#include "grow.c"
+#include "trace.c"
+#include "types.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include "win32.h"
+#else
+#include <time.h>
+#endif
+
+// Monotonic clock in nanoseconds
+static inline uint64_t clock_now_ns(void) {
+#ifdef _WIN32
+  static LARGE_INTEGER frequency;
+  if (!frequency.QuadPart)
+    QueryPerformanceFrequency(&frequency);
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000ull +
+         (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000ull /
+             (uint64_t)frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+enum Stage {
+  StageMap,     // mapping the frame image file
+  StageInflate, // decoding the image file (PNG) to pixels
+  StageUnbox,   // boxing_unboxer_unbox
+  StageSlice,   // cutting file contents out of decoded frame data
+  StageWrite,   // writing decoded file contents
+  StageHash,    // checksumming decoded file contents
+  StageCount,
+};
+
+static const char *const stage_names[StageCount] = {
+    "map", "inflate", "unbox", "slice", "write", "hash",
+};
+
+typedef struct {
+  uint64_t *samples; // durations in nanoseconds
+  size_t count;
+  size_t cap;
+} StageSamples;
+
+// Stages are recorded into the stats the recording thread has made current,
+// each unbox context has its own
+typedef struct {
+  bool enabled;
+  uint64_t start;
+  uint64_t bytes_written;
+  StageSamples stages[StageCount];
+} Stats;
+
+static THREAD_LOCAL Stats *stats_current;
+
+static inline Stats *stats_set_current(Stats *stats) {
+  Stats *previous = stats_current;
+  stats_current = stats;
+  return previous;
+}
+
+static inline bool stats_enabled(void) {
+  return stats_current && stats_current->enabled;
+}
+
+static inline void stats_enable(Stats *stats) {
+  memset(stats, 0, sizeof *stats);
+  stats->enabled = true;
+  stats->start = clock_now_ns();
+}
+
+// Start time of a stage, or 0 if neither stats nor a trace are being collected
+static inline uint64_t stats_clock(void) {
+  return stats_enabled() || trace_enabled() ? clock_now_ns() : 0;
+}
+
+static inline void stats_record(const enum Stage stage, const uint64_t start) {
+  if (!stats_enabled() && !trace_enabled())
+    return;
+  const uint64_t end = clock_now_ns();
+  trace_record(stage_names[stage], start, end);
+  if (!stats_enabled())
+    return;
+  StageSamples *s = &stats_current->stages[stage];
+  if (!grow((void **)&s->samples, sizeof *s->samples, &s->cap, s->count + 1))
+    return;
+  s->samples[s->count++] = end - start;
+}
+
+static inline void stats_add_bytes_written(const uint64_t bytes) {
+  if (stats_current)
+    stats_current->bytes_written += bytes;
+}
+
+static int compareU64(const void *a, const void *b) {
+  const uint64_t x = *(const uint64_t *)a;
+  const uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentileMs(const uint64_t *sorted, size_t count, unsigned p) {
+  if (!count)
+    return 0;
+  size_t rank = (count * p + 99) / 100;
+  return (double)sorted[rank ? rank - 1 : 0] / 1e6;
+}
+
+// Writes the report as a single line of JSON
+static inline void stats_write_json(Stats *stats, FILE *f) {
+  const double wall_s = (double)(clock_now_ns() - stats->start) / 1e9;
+  fputs("{\"stages\":{", f);
+  for (int i = 0; i < StageCount; i++) {
+    StageSamples *s = &stats->stages[i];
+    qsort(s->samples, s->count, sizeof *s->samples, compareU64);
+    uint64_t total = 0;
+    for (size_t j = 0; j < s->count; j++)
+      total += s->samples[j];
+    fprintf(f,
+            "%s\"%s\":{\"count\":%zu,\"total_ms\":%.3f,\"p50_ms\":%.3f,"
+            "\"p95_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}",
+            i ? "," : "", stage_names[i], s->count, (double)total / 1e6,
+            percentileMs(s->samples, s->count, 50),
+            percentileMs(s->samples, s->count, 95),
+            percentileMs(s->samples, s->count, 99),
+            s->count ? (double)s->samples[s->count - 1] / 1e6 : 0.0);
+  }
+  const size_t frames = stats->stages[StageUnbox].count;
+  fprintf(f,
+          "},\"frames\":%zu,\"bytes_written\":%" PRIu64 ",\"wall_s\":%.3f,"
+          "\"frames_per_s\":%.3f,\"mb_per_s\":%.3f}\n",
+          frames, stats->bytes_written, wall_s,
+          wall_s > 0 ? (double)frames / wall_s : 0.0,
+          wall_s > 0 ? (double)stats->bytes_written / 1e6 / wall_s : 0.0);
+}
+
+static inline void stats_free(Stats *stats) {
+  for (int i = 0; i < StageCount; i++)
+    free(stats->stages[i].samples);
+  memset(stats, 0, sizeof *stats);
+}
+
+#endif
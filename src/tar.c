@@ -0,0 +1,138 @@
+#ifndef TAR_C
+#define TAR_C
+
+#include "types.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Iterates the regular files of a tar archive held in memory (v7, ustar, GNU
+// long names and pax path records), handing out where their contents are in
+// the archive instead of copying them
+
+typedef struct {
+  Slice archive;
+  size_t offset; // of the next header
+} TarIterator;
+
+typedef struct {
+  char name[256]; // without the directories of the member's path
+  size_t offset;  // of the contents in the archive
+  size_t size;
+} TarEntry;
+
+// Octal, or base-256 (GNU) if the high bit of the first byte is set
+static uint64_t tar_number(const uint8_t *const restrict field,
+                           const size_t size) {
+  uint64_t x = 0;
+  if (field[0] & 0x80) {
+    x = field[0] & 0x3f;
+    for (size_t i = 1; i < size; i++)
+      x = x << 8 | field[i];
+    return x;
+  }
+  size_t i = 0;
+  while (i < size && field[i] == ' ')
+    i++;
+  for (; i < size && field[i] >= '0' && field[i] <= '7'; i++)
+    x = x << 3 | (uint64_t)(field[i] - '0');
+  return x;
+}
+
+// The checksum is the sum of all header bytes with its own field as spaces
+static bool tar_header_valid(const uint8_t *const restrict header) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < 512; i++)
+    sum += i >= 148 && i < 156 ? ' ' : header[i];
+  return sum == tar_number(header + 148, 8);
+}
+
+static size_t tar_string_length(const uint8_t *const restrict s,
+                                const size_t size) {
+  const uint8_t *const nul = memchr(s, 0, size);
+  return nul ? (size_t)(nul - s) : size;
+}
+
+// `path=` of a pax extended header, records are "<length> <key>=<value>\n"
+static bool tar_pax_path(const uint8_t *const restrict p, const size_t size,
+                         const uint8_t **path, size_t *path_size) {
+  size_t i = 0;
+  while (i < size) {
+    size_t length = 0;
+    size_t j = i;
+    for (; j < size && p[j] >= '0' && p[j] <= '9'; j++)
+      length = length * 10 + (size_t)(p[j] - '0');
+    if (j >= size || p[j] != ' ' || length < j - i + 2 || length > size - i)
+      return false;
+    const uint8_t *const record = p + j + 1;
+    const size_t record_size = i + length - (j + 1) - 1;
+    if (record_size >= 5 && memcmp(record, "path=", 5) == 0) {
+      *path = record + 5;
+      *path_size = record_size - 5;
+      return true;
+    }
+    i += length;
+  }
+  return false;
+}
+
+static bool tar_start(const Slice archive, TarIterator *const out) {
+  if (archive.size < 512 || !tar_header_valid(archive.data))
+    return false;
+  *out = (TarIterator){.archive = archive, .offset = 0};
+  return true;
+}
+
+// Returns false at the end of the archive or at the first malformed header
+static bool tar_next(TarIterator *const it, TarEntry *const out) {
+  const uint8_t *const archive = (const uint8_t *)it->archive.data;
+  // Set by a GNU long name or pax header for the member that follows it
+  const uint8_t *long_path = NULL;
+  size_t long_path_size = 0;
+  while (it->offset + 512 <= it->archive.size) {
+    const uint8_t *const header = archive + it->offset;
+    if (header[0] == 0 || !tar_header_valid(header))
+      return false;
+    const size_t contents = it->offset + 512;
+    const uint64_t size = tar_number(header + 124, 12);
+    if (size > it->archive.size - contents)
+      return false;
+    it->offset = contents + ((size_t)size + 511) / 512 * 512;
+
+    const uint8_t type = header[156];
+    if (type == 'L') {
+      long_path = archive + contents;
+      long_path_size = tar_string_length(long_path, (size_t)size);
+      continue;
+    }
+    if (type == 'x') {
+      if (!tar_pax_path(archive + contents, (size_t)size, &long_path,
+                        &long_path_size))
+        long_path = NULL;
+      continue;
+    }
+    if (type != '0' && type != '\0' && type != '7') {
+      long_path = NULL;
+      continue;
+    }
+
+    // The ustar prefix only holds directories, the name is enough
+    const uint8_t *path = long_path ? long_path : header;
+    size_t path_size =
+        long_path ? long_path_size : tar_string_length(header, 100);
+    size_t base = path_size;
+    while (base && path[base - 1] != '/')
+      base--;
+    path += base;
+    path_size -= base;
+    path_size = min(path_size, sizeof out->name - 1);
+    memcpy(out->name, path, path_size);
+    out->name[path_size] = '\0';
+    out->offset = contents;
+    out->size = (size_t)size;
+    return true;
+  }
+  return false;
+}
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef THREADS_C
+#define THREADS_C
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include "win32.h"
+#include <intrin.h>
+typedef void *Thread;
+typedef SRWLOCK Mutex;
+typedef CONDITION_VARIABLE Cond;
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Cond;
+#endif
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+typedef void (*ThreadFunction)(void *arg);
+
+typedef struct {
+  ThreadFunction function;
+  void *arg;
+} ThreadStart;
+
+#ifdef _WIN32
+static inline uint32_t WINAPI threadTrampoline(void *p) {
+#else
+static inline void *threadTrampoline(void *p) {
+#endif
+  ThreadStart start = *(ThreadStart *)p;
+  free(p);
+  start.function(start.arg);
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+static inline bool thread_start(Thread *thread, ThreadFunction function,
+                                void *arg) {
+  ThreadStart *start = malloc(sizeof *start);
+  if (!start)
+    return false;
+  *start = (ThreadStart){.function = function, .arg = arg};
+#ifdef _WIN32
+  *thread = CreateThread(NULL, 0, threadTrampoline, start, 0, NULL);
+  if (*thread == NULL) {
+#else
+  if (pthread_create(thread, NULL, threadTrampoline, start) != 0) {
+#endif
+    free(start);
+    return false;
+  }
+  return true;
+}
+
+static inline void thread_join(Thread thread) {
+#ifdef _WIN32
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_join(thread, NULL);
+#endif
+}
+
+static inline void thread_sleep_ms(unsigned ms) {
+#ifdef _WIN32
+  Sleep(ms);
+#else
+  struct timespec ts = {.tv_sec = ms / 1000,
+                        .tv_nsec = (long)(ms % 1000) * 1000000l};
+  nanosleep(&ts, NULL);
+#endif
+}
+
+static inline uint64_t thread_id(void) {
+#ifdef _WIN32
+  return GetCurrentThreadId();
+#else
+  // pthread_t is opaque, but an integer or pointer on every supported platform
+  return (uint64_t)(uintptr_t)pthread_self();
+#endif
+}
+
+static inline unsigned cpu_count(void) {
+#ifdef _WIN32
+  uint32_t n = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return n > 0 ? (unsigned)n : 1;
+}
+
+static inline void mutex_init(Mutex *mutex) {
+#ifdef _WIN32
+  InitializeSRWLock(mutex);
+#else
+  pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+static inline void mutex_destroy(Mutex *mutex) {
+#ifdef _WIN32
+  (void)mutex;
+#else
+  pthread_mutex_destroy(mutex);
+#endif
+}
+
+static inline void mutex_lock(Mutex *mutex) {
+#ifdef _WIN32
+  AcquireSRWLockExclusive(mutex);
+#else
+  pthread_mutex_lock(mutex);
+#endif
+}
+
+static inline void mutex_unlock(Mutex *mutex) {
+#ifdef _WIN32
+  ReleaseSRWLockExclusive(mutex);
+#else
+  pthread_mutex_unlock(mutex);
+#endif
+}
+
+static inline void cond_init(Cond *cond) {
+#ifdef _WIN32
+  InitializeConditionVariable(cond);
+#else
+  pthread_cond_init(cond, NULL);
+#endif
+}
+
+static inline void cond_destroy(Cond *cond) {
+#ifdef _WIN32
+  (void)cond;
+#else
+  pthread_cond_destroy(cond);
+#endif
+}
+
+static inline void cond_wait(Cond *cond, Mutex *mutex) {
+#ifdef _WIN32
+  SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+#else
+  pthread_cond_wait(cond, mutex);
+#endif
+}
+
+static inline void cond_signal(Cond *cond) {
+#ifdef _WIN32
+  WakeConditionVariable(cond);
+#else
+  pthread_cond_signal(cond);
+#endif
+}
+
+static inline void cond_broadcast(Cond *cond) {
+#ifdef _WIN32
+  WakeAllConditionVariable(cond);
+#else
+  pthread_cond_broadcast(cond);
+#endif
+}
+
+// 64-bit atomics with acquire / release ordering
+#ifdef _MSC_VER
+static inline uint64_t atomic_load_u64(volatile uint64_t *p) {
+  uint64_t v = *p;
+  _ReadWriteBarrier();
+  return v;
+}
+
+static inline void atomic_store_u64(volatile uint64_t *p, uint64_t v) {
+  _ReadWriteBarrier();
+  *p = v;
+}
+
+// On failure, *expected is updated to the current value
+static inline bool atomic_cas_u64(volatile uint64_t *p, uint64_t *expected,
+                                  uint64_t desired) {
+  uint64_t prev = (uint64_t)_InterlockedCompareExchange64(
+      (volatile __int64 *)p, (__int64)desired, (__int64)*expected);
+  if (prev == *expected)
+    return true;
+  *expected = prev;
+  return false;
+}
+
+// Returns the previous value
+static inline uint64_t atomic_add_u64(volatile uint64_t *p, uint64_t v) {
+  return (uint64_t)_InterlockedExchangeAdd64((volatile __int64 *)p, (__int64)v);
+}
+#else
+static inline uint64_t atomic_load_u64(volatile uint64_t *p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_store_u64(volatile uint64_t *p, uint64_t v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+// On failure, *expected is updated to the current value
+static inline bool atomic_cas_u64(volatile uint64_t *p, uint64_t *expected,
+                                  uint64_t desired) {
+  return __atomic_compare_exchange_n(p, expected, desired, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// Returns the previous value
+static inline uint64_t atomic_add_u64(volatile uint64_t *p, uint64_t v) {
+  return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL);
+}
+#endif
+
+#endif
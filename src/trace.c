@@ -0,0 +1,159 @@
+#ifndef TRACE_C
+#define TRACE_C
+
+#include "grow.c"
+#include "threads.c"
+#include "types.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Timeline of frame stages in the Chrome trace event format, loadable in
+// ui.perfetto.dev or chrome://tracing. Every thread appends to its own buffer,
+// so recording an event takes no lock. The buffers are only merged when the
+// trace is written. Events go to the trace the recording thread has made
+// current, each unbox context has its own.
+
+typedef struct {
+  const char *name;
+  uint64_t start; // nanoseconds
+  uint64_t end;
+  int32_t frame;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+  struct TraceBuffer *next;
+  uint32_t tid;
+  TraceEvent *events;
+  size_t count;
+  size_t cap;
+} TraceBuffer;
+
+typedef struct {
+  bool enabled;
+  uint64_t generation; // unique per trace_enable, never 0
+  uint64_t origin;
+  Mutex mutex; // protects buffers and next_tid
+  TraceBuffer *buffers;
+  uint32_t next_tid;
+} Trace;
+
+static THREAD_LOCAL Trace *trace_current;
+// This thread's buffer in the trace with generation `trace_buffer_owner`. A
+// trace freed on another thread leaves this behind, and a new trace may be
+// allocated at its address, so the owner is its generation, not its address.
+static THREAD_LOCAL TraceBuffer *trace_buffer;
+static THREAD_LOCAL uint64_t trace_buffer_owner;
+static volatile uint64_t trace_generations;
+// Frame the calling thread is working on, attached to its events
+static THREAD_LOCAL int32_t trace_frame = -1;
+
+static inline Trace *trace_set_current(Trace *trace) {
+  Trace *previous = trace_current;
+  trace_current = trace;
+  return previous;
+}
+
+static inline bool trace_enabled(void) {
+  return trace_current && trace_current->enabled;
+}
+
+static TraceBuffer *trace_thread_buffer(Trace *trace) {
+  if (trace_buffer && trace_buffer_owner == trace->generation)
+    return trace_buffer;
+  TraceBuffer *buffer = calloc(1, sizeof *buffer);
+  if (!buffer)
+    return NULL;
+  mutex_lock(&trace->mutex);
+  buffer->tid = trace->next_tid++;
+  buffer->next = trace->buffers;
+  trace->buffers = buffer;
+  mutex_unlock(&trace->mutex);
+  trace_buffer = buffer;
+  trace_buffer_owner = trace->generation;
+  return buffer;
+}
+
+static inline void trace_enable(Trace *trace, const uint64_t origin) {
+  mutex_init(&trace->mutex);
+  trace->generation = atomic_add_u64(&trace_generations, 1) + 1;
+  trace->origin = origin;
+  trace->buffers = NULL;
+  trace->next_tid = 1;
+  trace->enabled = true;
+  // Register the calling (main) thread first, so it gets tid 1
+  trace_thread_buffer(trace);
+}
+
+static inline void trace_set_frame(const int32_t frame) { trace_frame = frame; }
+
+static inline void trace_record(const char *const name, const uint64_t start,
+                                const uint64_t end) {
+  if (!trace_enabled())
+    return;
+  TraceBuffer *b = trace_thread_buffer(trace_current);
+  if (!b || !grow((void **)&b->events, sizeof *b->events, &b->cap,
+                  b->count + 1))
+    return;
+  b->events[b->count++] = (TraceEvent){
+      .name = name,
+      .start = start,
+      .end = end,
+      .frame = trace_frame,
+  };
+}
+
+// Call once all threads that recorded events are done
+static inline bool trace_write(const Trace *trace,
+                               const char *const restrict path) {
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return false;
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+  bool first = true;
+  for (TraceBuffer *b = trace->buffers; b; b = b->next) {
+    fprintf(f,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%" PRIu32
+            ",\"args\":{\"name\":\"%s %" PRIu32 "\"}}",
+            first ? "" : ",\n", b->tid, b->tid == 1 ? "main" : "thread",
+            b->tid);
+    first = false;
+    for (size_t i = 0; i < b->count; i++) {
+      const TraceEvent *e = &b->events[i];
+      fprintf(f,
+              ",\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,"
+              "\"dur\":%.3f,\"pid\":1,\"tid\":%" PRIu32
+              ",\"args\":{\"frame\":%" PRId32 "}}",
+              e->name, (double)(e->start - trace->origin) / 1e3,
+              (double)(e->end - e->start) / 1e3, b->tid, e->frame);
+    }
+  }
+  fputs("\n]}\n", f);
+  bool ok = !ferror(f);
+  ok = fclose(f) == 0 && ok;
+  return ok;
+}
+
+// Buffers of threads other than the caller are freed as well, their threads
+// must be done with the trace
+static inline void trace_free(Trace *trace) {
+  if (!trace->enabled)
+    return;
+  while (trace->buffers) {
+    TraceBuffer *next = trace->buffers->next;
+    free(trace->buffers->events);
+    free(trace->buffers);
+    trace->buffers = next;
+  }
+  if (trace_buffer_owner == trace->generation) {
+    trace_buffer = NULL;
+    trace_buffer_owner = 0;
+  }
+  mutex_destroy(&trace->mutex);
+  trace->generation = 0;
+  trace->enabled = false;
+}
+
+#endif
@@ -1,8 +1,11 @@
+#include "stats.c"
 #include "types.h"
 #include "unboxing_log.c"
 #include <boxing/unboxer.h>
 #include <inttypes.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 static const char *const boxing_unboxer_result_str[] = {
     "OK",
@@ -60,99 +63,173 @@ static void UnboxerDestroy(Unboxer *unboxer) {
   boxing_unboxer_parameters_free(&unboxer->parameters);
 }
 
-enum UnboxerUnboxStatus { UnboxOK, UnboxFailed };
-static enum UnboxerUnboxStatus
-UnboxerUnbox(Unboxer *unboxer, uint8_t *image_data, uint32_t width,
-             uint32_t height,
-             boxing_metadata_content_types fallback_metadata_content_type,
-             Slice *result) {
-  boxing_image8 image = {
-      .width = (unsigned)width,
-      .height = (unsigned)height,
-      .is_owning_data = DFALSE,
-      .data = image_data,
-  };
-  int extract_result = BOXING_UNBOXER_OK;
-  gvector data = {
-      .buffer = NULL,
-      .size = 0,
-      .item_size = 1,
-      .element_free = NULL,
-  };
-  enum boxing_unboxer_result decode_result = boxing_unboxer_unbox(
-      &data, unboxer->metadata, &image, unboxer->unboxer, &extract_result, NULL,
-      fallback_metadata_content_type);
+// Metadata decoded from a frame's structural metadata bar, plus the unboxing
+// results. `fields` has bit (1 << BOXING_METADATA_TYPE_*) set for every
+// metadata value that was present in the frame.
+typedef struct {
+  uint32_t fields;
+  uint32_t frame_number;
+  uint64_t data_crc;
+  uint32_t data_size;
+  uint32_t cipher_key;
+  uint16_t symbols_per_pixel;
+  uint16_t content_type;
+  uint16_t content_symbol_size;
+  int extract_result;
+  enum boxing_unboxer_result decode_result;
+} FrameInfo;
+
+#define FrameInfo_has(info, type) (((info)->fields >> (type)) & 1u)
+
+static void FrameInfo_read(FrameInfo *info, boxing_metadata_list *metadata) {
+  info->fields = 0;
   GHashTableIter it;
-  g_hash_table_iter_init(&it, unboxer->metadata);
+  g_hash_table_iter_init(&it, metadata);
   void *k;
   void *v;
-  char metadata_buf[4096];
-  size_t off = 0;
   while (g_hash_table_iter_next(&it, &k, &v)) {
     boxing_metadata_type type = (boxing_metadata_type) * (uint16_t *)k;
     boxing_metadata_item *item = (boxing_metadata_item *)v;
-    off += snprintf(metadata_buf + off, sizeof(metadata_buf) - off,
-                    "%s%s: ", off ? "\x1b[0m, " : "",
-                    boxing_metadata_type_str[type]);
     switch (type) {
     case BOXING_METADATA_TYPE_FRAMENUMBER:
-      off += snprintf(metadata_buf + off, sizeof(metadata_buf) - off,
-                      "\x1b[92m%u", ((boxing_metadata_item_u32 *)item)->value);
+      info->frame_number = ((boxing_metadata_item_u32 *)item)->value;
       break;
     case BOXING_METADATA_TYPE_DATACRC:
-      off += snprintf(metadata_buf + off, sizeof(metadata_buf) - off,
-                      "\x1b[93m%" PRIx64,
-                      ((boxing_metadata_item_u64 *)item)->value);
+      info->data_crc = ((boxing_metadata_item_u64 *)item)->value;
       break;
     case BOXING_METADATA_TYPE_DATASIZE:
-      off += snprintf(metadata_buf + off, sizeof(metadata_buf) - off,
-                      "\x1b[92m%u", ((boxing_metadata_item_u32 *)item)->value);
+      info->data_size = ((boxing_metadata_item_u32 *)item)->value;
       break;
     case BOXING_METADATA_TYPE_SYMBOLSPERPIXEL:
-      off += snprintf(metadata_buf + off, sizeof(metadata_buf) - off,
-                      "\x1b[92m%u", ((boxing_metadata_item_u16 *)item)->value);
+      info->symbols_per_pixel = ((boxing_metadata_item_u16 *)item)->value;
       break;
     case BOXING_METADATA_TYPE_CONTENTTYPE:
-      off +=
-          snprintf(metadata_buf + off, sizeof(metadata_buf) - off, "\x1b[96m%s",
-                   BOXING_METADATA_CONTENT_TYPE_STR(
-                       ((boxing_metadata_item_u16 *)item)->value));
+      info->content_type = ((boxing_metadata_item_u16 *)item)->value;
       break;
     case BOXING_METADATA_TYPE_CIPHERKEY:
-      off += snprintf(metadata_buf + off, sizeof(metadata_buf) - off,
-                      "\x1b[93m%x", ((boxing_metadata_item_u32 *)item)->value);
+      info->cipher_key = ((boxing_metadata_item_u32 *)item)->value;
       break;
     case BOXING_METADATA_TYPE_CONTENTSYMBOLSIZE:
-      off += snprintf(metadata_buf + off, sizeof(metadata_buf) - off,
-                      "\x1b[92m%u", ((boxing_metadata_item_u16 *)item)->value);
+      info->content_symbol_size = ((boxing_metadata_item_u16 *)item)->value;
       break;
     default:
-      off += snprintf(metadata_buf + off, sizeof(metadata_buf) - off,
-                      "\x1b[33m(TODO: format this type, size: %d)",
-                      item->base.size);
+      continue;
     }
+    info->fields |= 1u << type;
   }
-  boxing_log_args(BoxingLogLevelAlways,
+}
+
+static const char *unboxerResultColor(const int result) {
+  return result == BOXING_UNBOXER_OK         ? "\x1b[92m"
+         : result == BOXING_UNBOXER_SPLICING ? "\x1b[93m"
+                                             : "\x1b[91m";
+}
+
+static void appendFrameInfoField(char *const restrict buf, const size_t size,
+                                 size_t *const restrict off,
+                                 const boxing_metadata_type type,
+                                 const char *const restrict fmt, ...) {
+  if (*off >= size)
+    return;
+  int r = snprintf(buf + *off, size - *off, "%s%s: ", *off ? "\x1b[0m, " : "",
+                   boxing_metadata_type_str[type]);
+  if (r < 0)
+    return;
+  *off += (size_t)r;
+  if (*off >= size)
+    return;
+  va_list args;
+  va_start(args, fmt);
+  r = vsnprintf(buf + *off, size - *off, fmt, args);
+  va_end(args);
+  if (r > 0)
+    *off += (size_t)r;
+}
+
+// Formats a one-line summary of the frame, only if `level` is being logged
+static void FrameInfo_log(const FrameInfo *info,
+                          const enum BoxingLogLevel level) {
+  if (!boxing_log_enabled(level))
+    return;
+  char buf[1024];
+  size_t off = 0;
+  if (FrameInfo_has(info, BOXING_METADATA_TYPE_FRAMENUMBER))
+    appendFrameInfoField(buf, sizeof buf, &off,
+                         BOXING_METADATA_TYPE_FRAMENUMBER, "\x1b[92m%" PRIu32,
+                         info->frame_number);
+  if (FrameInfo_has(info, BOXING_METADATA_TYPE_DATACRC))
+    appendFrameInfoField(buf, sizeof buf, &off, BOXING_METADATA_TYPE_DATACRC,
+                         "\x1b[93m%" PRIx64, info->data_crc);
+  if (FrameInfo_has(info, BOXING_METADATA_TYPE_DATASIZE))
+    appendFrameInfoField(buf, sizeof buf, &off, BOXING_METADATA_TYPE_DATASIZE,
+                         "\x1b[92m%" PRIu32, info->data_size);
+  if (FrameInfo_has(info, BOXING_METADATA_TYPE_SYMBOLSPERPIXEL))
+    appendFrameInfoField(buf, sizeof buf, &off,
+                         BOXING_METADATA_TYPE_SYMBOLSPERPIXEL, "\x1b[92m%u",
+                         (unsigned)info->symbols_per_pixel);
+  if (FrameInfo_has(info, BOXING_METADATA_TYPE_CONTENTTYPE))
+    appendFrameInfoField(buf, sizeof buf, &off,
+                         BOXING_METADATA_TYPE_CONTENTTYPE, "\x1b[96m%s",
+                         BOXING_METADATA_CONTENT_TYPE_STR(info->content_type));
+  if (FrameInfo_has(info, BOXING_METADATA_TYPE_CIPHERKEY))
+    appendFrameInfoField(buf, sizeof buf, &off, BOXING_METADATA_TYPE_CIPHERKEY,
+                         "\x1b[93m%" PRIx32, info->cipher_key);
+  if (FrameInfo_has(info, BOXING_METADATA_TYPE_CONTENTSYMBOLSIZE))
+    appendFrameInfoField(buf, sizeof buf, &off,
+                         BOXING_METADATA_TYPE_CONTENTSYMBOLSIZE, "\x1b[92m%u",
+                         (unsigned)info->content_symbol_size);
+  off = min(off, sizeof buf - 1);
+  boxing_log_args(level,
                   "[%.*s\x1b[0m] extract: %s%s\x1b[0m, decode: %s%s\x1b[0m",
-                  (int)off, metadata_buf,
-                  extract_result == BOXING_UNBOXER_OK         ? "\x1b[92m"
-                  : extract_result == BOXING_UNBOXER_SPLICING ? "\x1b[93m"
-                                                              : "\x1b[91m",
-                  boxing_unboxer_result_str[extract_result],
-                  decode_result == BOXING_UNBOXER_OK         ? "\x1b[92m"
-                  : decode_result == BOXING_UNBOXER_SPLICING ? "\x1b[93m"
-                                                             : "\x1b[91m",
-                  boxing_unboxer_result_str[decode_result]);
+                  (int)off, buf, unboxerResultColor(info->extract_result),
+                  boxing_unboxer_result_str[info->extract_result],
+                  unboxerResultColor(info->decode_result),
+                  boxing_unboxer_result_str[info->decode_result]);
+}
+
+enum UnboxerUnboxStatus { UnboxOK, UnboxFailed };
+// Decodes one frame into caller-owned storage. `buffer` is in/out: it is passed
+// to the library as the gvector storage for the decoded data (so it must come
+// from malloc, or be Slice_empty). A gvector has no capacity, the library
+// reallocs the storage to the payload size of every frame, which for frames
+// of one size gets the same block back without copying. On return `buffer`
+// holds the current storage, which the caller keeps owning whether or not
+// decoding succeeded, and `result` points into it. If `info` is not NULL it
+// receives the frame metadata and unboxing results.
+static enum UnboxerUnboxStatus
+UnboxerUnbox(Unboxer *unboxer, uint8_t *image_data, uint32_t width,
+             uint32_t height,
+             boxing_metadata_content_types fallback_metadata_content_type,
+             Slice *buffer, Slice *result, FrameInfo *info) {
+  boxing_image8 image = {
+      .width = (unsigned)width,
+      .height = (unsigned)height,
+      .is_owning_data = DFALSE,
+      .data = image_data,
+  };
+  int extract_result = BOXING_UNBOXER_OK;
+  gvector data = {
+      .buffer = buffer->data,
+      .size = 0,
+      .item_size = 1,
+      .element_free = NULL,
+  };
+  uint64_t t0 = stats_clock();
+  enum boxing_unboxer_result decode_result = boxing_unboxer_unbox(
+      &data, unboxer->metadata, &image, unboxer->unboxer, &extract_result, NULL,
+      fallback_metadata_content_type);
+  stats_record(StageUnbox, t0);
+  if (info) {
+    FrameInfo_read(info, unboxer->metadata);
+    info->extract_result = extract_result;
+    info->decode_result = decode_result;
+  }
+  *buffer = (Slice){.data = data.buffer, .size = data.buffer ? data.size : 0};
   if (extract_result == BOXING_UNBOXER_OK &&
       decode_result == BOXING_UNBOXER_OK) {
-    if (data.buffer && data.size) {
-      *result = (Slice){.data = data.buffer, .size = data.size};
-    } else {
-      *result = (Slice){.data = NULL, .size = 0};
-    }
+    *result = *buffer;
     return UnboxOK;
   }
-  if (data.buffer)
-    free(data.buffer);
+  *result = Slice_empty;
   return UnboxFailed;
 }
@@ -1,15 +1,28 @@
 #ifndef UNBOXING_LOG_C
 #define UNBOXING_LOG_C
 
+#include "threads.c"
+#include "types.h"
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 enum BoxingLogLevel {
   BoxingLogLevelInfo = 0,
   BoxingLogLevelWarning = 1,
   BoxingLogLevelError = 2,
   BoxingLogLevelFatal = 3,
-  BoxingLogLevelAlways = 4,
+  BoxingLogLevelAlways = 4, // shown at any threshold
+  BoxingLogLevelDebug = 5,  // below info, values 0 to 4 are shared with afs
+};
+
+enum BoxingLogFormat {
+  BoxingLogFormatAnsi,  // colored level, messages as-is
+  BoxingLogFormatPlain, // no escape sequences
+  BoxingLogFormatJson,  // one JSON object per line
 };
 
 void boxing_log(const enum BoxingLogLevel level,
@@ -18,25 +31,414 @@ void boxing_log(const enum BoxingLogLevel level,
 void boxing_log_args(const enum BoxingLogLevel level,
                      const char *const restrict fmt, ...);
 
+// Receives every message at or above the threshold, unformatted
+typedef void (*BoxingLogSink)(void *user, enum BoxingLogLevel level,
+                              const char *message, size_t length);
+
+typedef struct BoxingLogRing BoxingLogRing;
+
+// Where the messages of one unbox context go. The library calls boxing_log
+// without a context, so messages go to the BoxingLog the calling thread has
+// made current, or are written to stderr as is if it has none.
+typedef struct {
+  // Messages below this level are dropped before they are formatted
+  enum BoxingLogLevel threshold;
+  enum BoxingLogFormat format; // of lines written to stderr
+  BoxingLogSink sink;          // NULL to write formatted lines to stderr
+  void *sink_user;
+  BoxingLogRing *ring; // set while logging asynchronously
+} BoxingLog;
+
+static THREAD_LOCAL BoxingLog *boxing_log_current;
+
+static const BoxingLog boxing_log_default = {
+    .threshold = BoxingLogLevelInfo,
+    .format = BoxingLogFormatAnsi,
+    .sink = NULL,
+    .sink_user = NULL,
+    .ring = NULL,
+};
+
+// Makes `log` the destination of this thread's messages, returns the previous
+// one to restore
+static inline BoxingLog *boxing_log_set_current(BoxingLog *log) {
+  BoxingLog *previous = boxing_log_current;
+  boxing_log_current = log;
+  return previous;
+}
+
+static inline const BoxingLog *boxing_log_get(void) {
+  return boxing_log_current ? boxing_log_current : &boxing_log_default;
+}
+
+// Levels in order of severity, debug sorts below info
+static inline int boxing_log_rank(const enum BoxingLogLevel level) {
+  return level == BoxingLogLevelDebug ? -1 : (int)level;
+}
+
+static bool boxing_log_passes(const BoxingLog *log,
+                              const enum BoxingLogLevel level) {
+  return boxing_log_rank(level) >= boxing_log_rank(log->threshold);
+}
+
+static bool boxing_log_enabled(const enum BoxingLogLevel level) {
+  return boxing_log_passes(boxing_log_get(), level);
+}
+
 static const char *boxing_log_level_str[] = {
     "\x1b[36mINFO\x1b[0m   ", "\x1b[33mWARNING\x1b[0m",
     "\x1b[31mERROR\x1b[0m  ", "\x1b[31mFATAL\x1b[0m  ",
-    "\x1b[35mDEBUG\x1b[0m  ",
+    "\x1b[36mINFO\x1b[0m   ", "\x1b[35mDEBUG\x1b[0m  ",
+};
+
+static const char *const boxing_log_level_name[] = {
+    "info", "warning", "error", "fatal", "info", "debug",
 };
 
+// Thresholds from most to least verbose, "quiet" only lets through messages
+// logged at BoxingLogLevelAlways
+static inline bool boxing_log_parse_level(const char *const restrict str,
+                                          enum BoxingLogLevel *out) {
+  static const struct {
+    const char *name;
+    enum BoxingLogLevel level;
+  } levels[] = {
+      {"debug", BoxingLogLevelDebug},     {"info", BoxingLogLevelInfo},
+      {"warning", BoxingLogLevelWarning}, {"error", BoxingLogLevelError},
+      {"fatal", BoxingLogLevelFatal},     {"quiet", BoxingLogLevelAlways},
+  };
+  for (size_t i = 0; i < countof(levels); i++) {
+    if (strcmp(str, levels[i].name) == 0) {
+      *out = levels[i].level;
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline bool boxing_log_parse_format(const char *const restrict str,
+                                           enum BoxingLogFormat *out) {
+  if (strcmp(str, "ansi") == 0)
+    *out = BoxingLogFormatAnsi;
+  else if (strcmp(str, "plain") == 0)
+    *out = BoxingLogFormatPlain;
+  else if (strcmp(str, "json") == 0)
+    *out = BoxingLogFormatJson;
+  else
+    return false;
+  return true;
+}
+
+// Worst case size of a formatted line, JSON may escape a byte to 6 bytes
+static size_t boxing_log_line_size(const enum BoxingLogFormat format,
+                                   const size_t msg_len) {
+  return (format == BoxingLogFormatJson ? msg_len * 6 : msg_len) + 64;
+}
+
+// Appends one formatted line to `out`, returns the new length (unchanged if
+// the line does not fit)
+static size_t boxing_log_format_line(char *const restrict out, size_t len,
+                                     const size_t cap,
+                                     const enum BoxingLogFormat format,
+                                     const enum BoxingLogLevel level,
+                                     const char *const restrict msg,
+                                     const size_t msg_len) {
+  if (cap - len < boxing_log_line_size(format, msg_len))
+    return len;
+  if (format == BoxingLogFormatAnsi) {
+    const size_t level_len = strlen(boxing_log_level_str[level]);
+    memcpy(out + len, boxing_log_level_str[level], level_len);
+    len += level_len;
+    out[len++] = ' ';
+    memcpy(out + len, msg, msg_len);
+    len += msg_len;
+    out[len++] = '\n';
+    return len;
+  }
+  const bool json = format == BoxingLogFormatJson;
+  len += (size_t)snprintf(out + len, cap - len,
+                          json ? "{\"level\":\"%s\",\"message\":\"" : "%-8s",
+                          boxing_log_level_name[level]);
+  for (size_t i = 0; i < msg_len; i++) {
+    const unsigned char c = (unsigned char)msg[i];
+    if (c == 0x1b) {
+      // Strip SGR escape sequences (colors)
+      while (i < msg_len && msg[i] != 'm')
+        i++;
+      continue;
+    }
+    if (json && (c == '"' || c == '\\')) {
+      out[len++] = '\\';
+      out[len++] = (char)c;
+    } else if (json && c < 0x20) {
+      len += (size_t)snprintf(out + len, cap - len, "\\u%04x", c);
+    } else {
+      out[len++] = (char)c;
+    }
+  }
+  if (json) {
+    memcpy(out + len, "\"}", 2);
+    len += 2;
+  }
+  out[len++] = '\n';
+  return len;
+}
+
+// Hands a message to the sink without the SGR escape sequences (colors) some
+// messages carry for the ANSI format, sinks get plain text
+static void boxing_log_to_sink(const BoxingLog *log,
+                               const enum BoxingLogLevel level,
+                               const char *const restrict msg,
+                               const size_t msg_len) {
+  if (!memchr(msg, 0x1b, msg_len)) {
+    log->sink(log->sink_user, level, msg, msg_len);
+    return;
+  }
+  char stack[1024];
+  char *const plain = msg_len <= sizeof stack ? stack : malloc(msg_len);
+  if (!plain)
+    return;
+  size_t len = 0;
+  for (size_t i = 0; i < msg_len; i++) {
+    if (msg[i] == 0x1b) {
+      while (i < msg_len && msg[i] != 'm')
+        i++;
+      continue;
+    }
+    plain[len++] = msg[i];
+  }
+  log->sink(log->sink_user, level, plain, len);
+  if (plain != stack)
+    free(plain);
+}
+
+static void boxing_log_write(const BoxingLog *log,
+                             const enum BoxingLogLevel level,
+                             const char *const restrict msg,
+                             const size_t msg_len) {
+  if (log->sink) {
+    boxing_log_to_sink(log, level, msg, msg_len);
+    return;
+  }
+  char buf[8192];
+  size_t len = msg_len;
+  while (boxing_log_line_size(log->format, len) > sizeof buf)
+    len /= 2;
+  len = boxing_log_format_line(buf, 0, sizeof buf, log->format, level, msg,
+                               len);
+  fwrite(buf, 1, len, stderr);
+}
+
+// Asynchronous mode: messages are formatted straight into the slots of a
+// bounded lock-free ring buffer (multiple producers, one consumer) and handed
+// to the sink or stderr by a background thread, so logging threads never wait
+// on the stdio lock or a slow sink. When the ring is full, messages are
+// dropped and counted. The consumer sleeps while nothing is pending and is
+// woken by the producer that publishes into the empty ring.
+
+#define LOG_RING_SLOTS 1024u
+#define LOG_MESSAGE_SIZE 512u
+
+typedef struct {
+  volatile uint64_t sequence;
+  enum BoxingLogLevel level;
+  uint32_t length;
+  char message[LOG_MESSAGE_SIZE];
+} LogSlot;
+
+struct BoxingLogRing {
+  LogSlot slots[LOG_RING_SLOTS];
+  volatile uint64_t head; // next position claimed by a producer
+  uint64_t tail;          // next position read by the consumer
+  volatile uint64_t dropped;
+  volatile uint64_t running;
+  volatile uint64_t pending; // published and not drained, may briefly wrap
+  Mutex mutex;               // with `wake`, for the consumer to sleep on
+  Cond wake;
+  Thread thread;
+  const BoxingLog *log;
+  char buf[64 * 1024]; // lines formatted by the consumer
+};
+
+static LogSlot *boxing_log_claim(BoxingLogRing *ring) {
+  uint64_t pos = atomic_load_u64(&ring->head);
+  for (;;) {
+    LogSlot *slot = &ring->slots[pos % LOG_RING_SLOTS];
+    const int64_t diff = (int64_t)(atomic_load_u64(&slot->sequence) - pos);
+    if (diff == 0) {
+      if (atomic_cas_u64(&ring->head, &pos, pos + 1))
+        return slot;
+    } else if (diff < 0) {
+      atomic_add_u64(&ring->dropped, 1);
+      return NULL;
+    } else {
+      pos = atomic_load_u64(&ring->head);
+    }
+  }
+}
+
+static void boxing_log_wake(BoxingLogRing *ring) {
+  mutex_lock(&ring->mutex);
+  cond_signal(&ring->wake);
+  mutex_unlock(&ring->mutex);
+}
+
+// A slot with sequence number `pos` is free for the producer claiming position
+// `pos`, and `pos + 1` marks it as filled and ready for the consumer.
+static void boxing_log_publish(BoxingLogRing *ring, LogSlot *slot) {
+  atomic_store_u64(&slot->sequence, atomic_load_u64(&slot->sequence) + 1);
+  if (atomic_add_u64(&ring->pending, 1) == 0)
+    boxing_log_wake(ring);
+}
+
+static size_t boxing_log_drain(BoxingLogRing *ring) {
+  const BoxingLog *log = ring->log;
+  const size_t cap = sizeof ring->buf;
+  char *const buf = ring->buf;
+  size_t drained = 0;
+  size_t len = 0;
+  for (;;) {
+    LogSlot *slot = &ring->slots[ring->tail % LOG_RING_SLOTS];
+    if (atomic_load_u64(&slot->sequence) != ring->tail + 1)
+      break;
+    if (log->sink) {
+      boxing_log_to_sink(log, slot->level, slot->message, slot->length);
+    } else {
+      const size_t next =
+          boxing_log_format_line(buf, len, cap, log->format, slot->level,
+                                 slot->message, slot->length);
+      if (next == len) {
+        fwrite(buf, 1, len, stderr);
+        len = boxing_log_format_line(buf, 0, cap, log->format, slot->level,
+                                     slot->message, slot->length);
+      } else {
+        len = next;
+      }
+    }
+    atomic_store_u64(&slot->sequence, ring->tail + LOG_RING_SLOTS);
+    ring->tail++;
+    drained++;
+  }
+  if (len)
+    fwrite(buf, 1, len, stderr);
+  return drained;
+}
+
+static void boxing_log_consumer(void *arg) {
+  BoxingLogRing *ring = arg;
+  uint64_t reported_dropped = 0;
+  for (;;) {
+    const bool running = atomic_load_u64(&ring->running) != 0;
+    const size_t drained = boxing_log_drain(ring);
+    const uint64_t dropped = atomic_load_u64(&ring->dropped);
+    if (dropped != reported_dropped) {
+      char msg[64];
+      const int len =
+          snprintf(msg, sizeof msg, "Dropped %llu log message(s)",
+                   (unsigned long long)(dropped - reported_dropped));
+      boxing_log_write(ring->log, BoxingLogLevelWarning, msg, (size_t)len);
+      reported_dropped = dropped;
+    }
+    if (!running)
+      break;
+    if (atomic_add_u64(&ring->pending, (uint64_t)0 - drained) != drained)
+      continue;
+    if (!ring->log->sink)
+      fflush(stderr);
+    // Producers bump `pending` before taking the mutex to signal, so a
+    // message published after the check still wakes the consumer
+    mutex_lock(&ring->mutex);
+    while (atomic_load_u64(&ring->pending) == 0 &&
+           atomic_load_u64(&ring->running))
+      cond_wait(&ring->wake, &ring->mutex);
+    mutex_unlock(&ring->mutex);
+  }
+  if (!ring->log->sink)
+    fflush(stderr);
+}
+
+// Flushes all pending messages and returns to synchronous logging
+static inline void boxing_log_stop_async(BoxingLog *log) {
+  if (!log->ring)
+    return;
+  atomic_store_u64(&log->ring->running, 0);
+  boxing_log_wake(log->ring);
+  thread_join(log->ring->thread);
+  cond_destroy(&log->ring->wake);
+  mutex_destroy(&log->ring->mutex);
+  free(log->ring);
+  log->ring = NULL;
+}
+
+static inline bool boxing_log_start_async(BoxingLog *log) {
+  if (log->ring)
+    return true;
+  BoxingLogRing *ring = malloc(sizeof *ring);
+  if (!ring)
+    return false;
+  for (uint64_t i = 0; i < LOG_RING_SLOTS; i++)
+    ring->slots[i].sequence = i;
+  ring->head = 0;
+  ring->tail = 0;
+  ring->dropped = 0;
+  ring->running = 1;
+  ring->pending = 0;
+  ring->log = log;
+  mutex_init(&ring->mutex);
+  cond_init(&ring->wake);
+  if (!thread_start(&ring->thread, boxing_log_consumer, ring)) {
+    cond_destroy(&ring->wake);
+    mutex_destroy(&ring->mutex);
+    free(ring);
+    return false;
+  }
+  log->ring = ring;
+  return true;
+}
+
 void boxing_log(const enum BoxingLogLevel level,
                 const char *const restrict str) {
-  fprintf(stderr, "%s %s\n", boxing_log_level_str[level], str);
+  const BoxingLog *log = boxing_log_get();
+  if (!boxing_log_passes(log, level))
+    return;
+  const size_t len = strlen(str);
+  if (log->ring) {
+    LogSlot *slot = boxing_log_claim(log->ring);
+    if (!slot)
+      return;
+    slot->level = level;
+    slot->length = (uint32_t)min(len, LOG_MESSAGE_SIZE);
+    memcpy(slot->message, str, slot->length);
+    boxing_log_publish(log->ring, slot);
+    return;
+  }
+  boxing_log_write(log, level, str, len);
 }
 
 void boxing_log_args(const enum BoxingLogLevel level,
                      const char *const restrict fmt, ...) {
+  const BoxingLog *log = boxing_log_get();
+  if (!boxing_log_passes(log, level))
+    return;
   va_list args;
   va_start(args, fmt);
+  if (log->ring) {
+    LogSlot *slot = boxing_log_claim(log->ring);
+    if (slot) {
+      const int len = vsnprintf(slot->message, LOG_MESSAGE_SIZE, fmt, args);
+      slot->level = level;
+      slot->length =
+          len < 0 ? 0 : (uint32_t)min((unsigned)len, LOG_MESSAGE_SIZE - 1);
+      boxing_log_publish(log->ring, slot);
+    }
+    va_end(args);
+    return;
+  }
   char buf[4096];
   const int len = vsnprintf(buf, sizeof(buf), fmt, args);
   va_end(args);
-  fprintf(stderr, "%s %.*s\n", boxing_log_level_str[level], len, buf);
+  boxing_log_write(log, level, buf,
+                   len < 0 ? 0 : min((size_t)len, sizeof(buf) - 1));
 }
 
 #endif
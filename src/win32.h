@@ -36,6 +36,14 @@ typedef struct {
   char cAlternateFileName[14];
 } WIN32_FIND_DATAA;
 
+typedef struct {
+  void *Ptr;
+} SRWLOCK;
+
+typedef struct {
+  void *Ptr;
+} CONDITION_VARIABLE;
+
 #define WINBASEAPI __declspec(dllimport)
 #define WINAPI __stdcall
 
@@ -48,6 +56,9 @@ WINBASEAPI void *WINAPI CreateFileA(
 WINBASEAPI int32_t WINAPI GetFileSizeEx(void *hFile, LARGE_INTEGER *lpFileSize);
 WINBASEAPI uint32_t WINAPI GetCurrentDirectoryA(uint32_t nBufferLength, char *lpBuffer);
 WINBASEAPI int32_t WINAPI CloseHandle(void *hObject);
+WINBASEAPI int32_t WINAPI
+CreateHardLinkA(const char *lpFileName, const char *lpExistingFileName,
+                SECURITY_ATTRIBUTES *lpSecurityAttributes);
 WINBASEAPI void *WINAPI
 CreateFileMappingA(void *hFile, SECURITY_ATTRIBUTES *lpFileMappingAttributes,
                    uint32_t flProtect, uint32_t dwMaximumSizeHigh,
@@ -79,6 +90,25 @@ WINBASEAPI int32_t WINAPI FindNextFileA(void *hFindFile,
                                         WIN32_FIND_DATAA *lpFindFileData);
 WINBASEAPI int32_t WINAPI FindClose(void *hFindFile);
 WINBASEAPI int32_t WINAPI SetConsoleOutputCP(unsigned int wCodePageID);
+WINBASEAPI void WINAPI InitializeSRWLock(SRWLOCK *SRWLock);
+WINBASEAPI void WINAPI AcquireSRWLockExclusive(SRWLOCK *SRWLock);
+WINBASEAPI void WINAPI ReleaseSRWLockExclusive(SRWLOCK *SRWLock);
+WINBASEAPI void WINAPI
+InitializeConditionVariable(CONDITION_VARIABLE *ConditionVariable);
+WINBASEAPI int32_t WINAPI
+SleepConditionVariableSRW(CONDITION_VARIABLE *ConditionVariable,
+                          SRWLOCK *SRWLock, uint32_t dwMilliseconds,
+                          uint32_t Flags);
+WINBASEAPI void WINAPI
+WakeConditionVariable(CONDITION_VARIABLE *ConditionVariable);
+WINBASEAPI void WINAPI
+WakeAllConditionVariable(CONDITION_VARIABLE *ConditionVariable);
+WINBASEAPI void WINAPI Sleep(uint32_t dwMilliseconds);
+WINBASEAPI uint32_t WINAPI GetCurrentThreadId(void);
+WINBASEAPI uint32_t WINAPI GetActiveProcessorCount(uint16_t GroupNumber);
+WINBASEAPI int32_t WINAPI
+QueryPerformanceCounter(LARGE_INTEGER *lpPerformanceCount);
+WINBASEAPI int32_t WINAPI QueryPerformanceFrequency(LARGE_INTEGER *lpFrequency);
 
 #define GENERIC_READ (0x80000000L)
 #define GENERIC_WRITE (0x40000000L)
@@ -159,6 +189,8 @@ WINBASEAPI int32_t WINAPI SetConsoleOutputCP(unsigned int wCodePageID);
 #define WAIT_OBJECT_0 ((STATUS_WAIT_0) + 0)
 #define INFINITE 0xFFFFFFFF
 
+#define ALL_PROCESSOR_GROUPS 0xffff
+
 #define FALSE 0
 #define TRUE 1
 